@@ -0,0 +1,124 @@
+// AlignLog.h
+
+#ifndef FLEXBAR_ALIGNLOG_H
+#define FLEXBAR_ALIGNLOG_H
+
+
+// Alignment log records are formatted into buffers of worker threads. Records
+// of a bundle are handed over after alignment and written in bundle order by
+// a separate writer thread, workers never wait for the log stream.
+class AlignLog {
+
+private:
+	
+	// stream of thread, copies start with empty stream
+	struct LogBuffer {
+		
+		std::ostringstream s;
+		
+		LogBuffer(){}
+		LogBuffer(const LogBuffer &){}
+	};
+	
+	typedef tbb::concurrent_hash_map<const void*, std::string> TBundleLogs;
+	
+	const bool m_enabled;
+	
+	tbb::enumerable_thread_specific<LogBuffer> m_buffers;
+	TBundleLogs m_bundleLogs;
+	
+	// records of bundles in order, NULL stops writer
+	tbb::concurrent_bounded_queue<std::string*> m_queue;
+	
+	std::ostream *m_out;
+	std::thread m_writer;
+	
+public:
+	
+	AlignLog(const Options &o) :
+		
+		m_enabled(o.logAlign != flexbar::NONE),
+		m_out(o.out){
+		
+		if(m_enabled){
+			
+			// limits memory of records if writer falls behind
+			m_queue.set_capacity(4 * o.nTokens + 4);
+			
+			m_writer = std::thread(&AlignLog::writeRecords, this);
+		}
+	};
+	
+	
+	virtual ~AlignLog(){
+		close();
+	};
+	
+	
+	// stream for log records of current thread
+	std::ostream& stream(){
+		return m_buffers.local().s;
+	}
+	
+	
+	// takes records of current thread as records of processed bundle
+	void commit(const void *bundle){
+		
+		if(! m_enabled) return;
+		
+		std::ostringstream &s = m_buffers.local().s;
+		
+		if(s.tellp() <= 0) return;
+		
+		TBundleLogs::accessor acc;
+		m_bundleLogs.insert(acc, bundle);
+		
+		acc->second = s.str();
+		s.str("");
+	}
+	
+	
+	// queues records of bundle for writing, called in bundle order
+	void write(const void *bundle){
+		
+		if(! m_enabled) return;
+		
+		TBundleLogs::accessor acc;
+		
+		if(m_bundleLogs.find(acc, bundle)){
+			
+			m_queue.push(new std::string(std::move(acc->second)));
+			m_bundleLogs.erase(acc);
+		}
+	}
+	
+	
+	// waits until all queued records are written
+	void close(){
+		
+		if(m_writer.joinable()){
+			m_queue.push(NULL);
+			m_writer.join();
+		}
+	}
+	
+private:
+	
+	void writeRecords(){
+		
+		std::string *records;
+		
+		while(true){
+			m_queue.pop(records);
+			
+			if(records == NULL) break;
+			
+			*m_out << *records;
+			delete records;
+		}
+		m_out->flush();
+	}
+	
+};
+
+#endif
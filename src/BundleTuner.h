@@ -0,0 +1,69 @@
+// BundleTuner.h
+
+#ifndef FLEXBAR_BUNDLETUNER_H
+#define FLEXBAR_BUNDLETUNER_H
+
+
+// Adapts number of reads per bundle toward a target time of alignment stage
+// for each bundle. Alignment time per read is averaged over recent bundles.
+class BundleTuner {
+
+private:
+	
+	const bool m_adaptive;
+	const double m_targetTime;
+	const unsigned int m_minSize, m_maxSize;
+	
+	std::atomic<unsigned int> m_bundleSize;
+	
+	double m_readTime;
+	std::mutex m_mutex;
+	
+public:
+	
+	BundleTuner(const Options &o) :
+		
+		m_adaptive(o.bundleTime > 0),
+		m_targetTime(o.bundleTime / 1000.0),
+		m_minSize(o.bundleMin),
+		m_maxSize(o.bundleMax),
+		m_bundleSize(o.bundleSize),
+		m_readTime(0){
+	};
+	
+	
+	unsigned int getBundleSize() const {
+		return m_bundleSize;
+	}
+	
+	
+	// measures alignment stage of bundle that started at given time
+	void addBundleTime(const unsigned int nReads, const std::chrono::steady_clock::time_point &start){
+		
+		if(! m_adaptive || nReads == 0) return;
+		
+		std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+		
+		std::lock_guard<std::mutex> lock(m_mutex);
+		
+		double readTime = time.count() / nReads;
+		
+		if(m_readTime == 0) m_readTime = readTime;
+		else                m_readTime = 0.8 * m_readTime + 0.2 * readTime;
+		
+		double size = (m_readTime > 0) ? m_targetTime / m_readTime : m_maxSize;
+		
+		     if(size < m_minSize) m_bundleSize = m_minSize;
+		else if(size > m_maxSize) m_bundleSize = m_maxSize;
+		else                      m_bundleSize = static_cast<unsigned int>(size);
+	}
+	
+	
+	void printBundleSize(std::ostream *out) const {
+		
+		if(m_adaptive) *out << "Final bundle size:  " << m_bundleSize << "\n";
+	}
+	
+};
+
+#endif
@@ -7,7 +7,7 @@
    BSD 3-Clause License
    
    uses SeqAn library release 2.4.0
-   and TBB library 4.0 or later
+   and oneTBB library 2021 or later
    
    
              Developer:  Johannes Roehr
@@ -11,10 +11,27 @@
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 
-#include <tbb/pipeline.h>
-#include <tbb/task_scheduler_init.h>
+#include <sys/resource.h>
+
+#include <tbb/parallel_pipeline.h>
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#include <tbb/info.h>
+#include <tbb/parallel_for_each.h>
 #include <tbb/concurrent_vector.h>
+#include <tbb/concurrent_hash_map.h>
+#include <tbb/concurrent_queue.h>
+#include <tbb/enumerable_thread_specific.h>
 
 #include <seqan/basic.h>
 #include <seqan/sequence.h>
@@ -26,6 +43,13 @@
 #include "FlexbarTypes.h"
 #include "Options.h"
 #include "FlexbarIO.h"
+#include "AlignLog.h"
+#include "MemoryBudget.h"
+#include "BundleTuner.h"
+#include "StageBalance.h"
+#include "StageTimers.h"
+#include "PerfCounters.h"
+#include "NumaPipeline.h"
 #include "LoadFasta.h"
 #include "LoadAdapters.h"
 #include "SeqInput.h"
@@ -235,17 +259,44 @@ void startProcessing(Options &o){
 	
 	if(o.logAlign != NONE) *out << "\n\nAlignment " << o.logAlignStr << " logging:\n\n" << endl;
 	
-	PairedInput<TSeqStr, TString>  inputFilter(o);
-	PairedAlign<TSeqStr, TString>  alignFilter(o);
-	PairedOutput<TSeqStr, TString> outputFilter(o);
+	AlignLog alignLog(o);
+	MemoryBudget memory(o);
+	BundleTuner tuner(o);
+	StageBalance balance(o);
+	StageTimers timers(o);
+	PerfCounters perf(o);
+	
+	PairedInput<TSeqStr, TString>  inputFilter(o, &tuner, &memory, &balance, &timers, &perf);
+	PairedAlign<TSeqStr, TString>  alignFilter(o, &alignLog, &tuner, &balance, &timers, &perf);
+	PairedOutput<TSeqStr, TString> outputFilter(o, &alignLog, &memory, &balance, &timers, &perf);
+	
+	typedef PairedInput<TSeqStr, TString>  TInput;
+	typedef PairedAlign<TSeqStr, TString>  TAlign;
+	typedef PairedOutput<TSeqStr, TString> TOutput;
 	
-	tbb::task_scheduler_init init_serial(o.nThreads);
-	tbb::pipeline pipe;
+	NumaPipeline<TInput, TAlign, TOutput> numaPipeline(o, inputFilter, alignFilter, outputFilter);
 	
-	pipe.add_filter(inputFilter);
-	pipe.add_filter(alignFilter);
-	pipe.add_filter(outputFilter);
-	pipe.run(o.nThreads);
+	const bool useNuma = o.numa && numaPipeline.getNrReplicas() > 1;
+	
+	// arenas of replicas reserve no slot for main thread
+	tbb::global_control control(tbb::global_control::max_allowed_parallelism, useNuma ? o.nThreads + 1 : o.nThreads);
+	
+	if(useNuma) numaPipeline.run();
+	else{
+		// number of bundles in flight is independent of number of threads
+		tbb::parallel_pipeline(o.nTokens,
+			tbb::make_filter<void, TPairedReadBundle*>(tbb::filter_mode::serial_in_order,
+				[&](tbb::flow_control &fc){ return inputFilter(fc); }) &
+			tbb::make_filter<TPairedReadBundle*, TPairedReadBundle*>(tbb::filter_mode::parallel,
+				[&](TPairedReadBundle *prBundle){ return alignFilter(prBundle); }) &
+			tbb::make_filter<TPairedReadBundle*, void>(tbb::filter_mode::serial_in_order,
+				[&](TPairedReadBundle *prBundle){ outputFilter(prBundle); })
+		);
+	}
+	
+	alignLog.close();
+	alignFilter.mergeStatistics();
+	timers.finish();
 	
 	if(o.logAlign == TAB) *out << "\n";
 	*out << "done.\n" << endl;
@@ -253,6 +304,17 @@ void startProcessing(Options &o){
 	
 	const unsigned long nReads = inputFilter.getNrProcessedReads();
 	
+	memory.printPeakMemory(out);
+	tuner.printBundleSize(out);
+	balance.printStageBalance(out);
+	if(useNuma) numaPipeline.printReplicas(out);
+	
+	if(o.stageTimes)     timers.printStageTimes(out);
+	if(o.stageTimesJson) timers.writeStageTimes(o.targetName + ".times.json");
+	if(o.traceBundles)   timers.writeTrace(o.targetName + ".trace.json");
+	
+	perf.printPerfCounters(out);
+	
 	printComputationTime(o, start, nReads);
 	
 	
@@ -89,13 +89,64 @@ namespace flexbar{
 	typedef SeqRead<FSeqStr, FString>    TSeqRead;
 	typedef PairedRead<FSeqStr, FString> TPairedRead;
 	
-	typedef seqan::Align<FSeqStr, seqan::ArrayGaps> TAlign;
-	typedef seqan::StringSet<TAlign>                TAlignSet;
-	typedef seqan::String<int>                      TAlignScores;
+	typedef seqan::Infix<FSeqStr>::Type               TSeqInfix;
+	typedef seqan::Align<TSeqInfix, seqan::ArrayGaps> TAlign;
+	typedef seqan::StringSet<TAlign>                  TAlignSet;
+	typedef seqan::String<int>                        TAlignScores;
 	
 	struct Alignments {
 		TAlignSet aset;
 		TAlignScores ascores;
+		
+		// sequences of rows that are not stored in reads or queries
+		std::deque<FSeqStr> seqs;
+		
+		// reads with cached alignment in preload cycle
+		std::vector<bool> cached;
+		unsigned int idxCached;
+		
+		// groups of identical reads in bundle, first read is aligned for group
+		std::unordered_map<std::string, unsigned int> groupIds;
+		std::vector<unsigned int> groups;
+		std::vector<int> groupQuery;
+		std::vector<AlignResults<FSeqStr> > groupResults;
+		unsigned int idxGroup;
+		
+		Alignments() :
+			idxCached(0),
+			idxGroup(0){
+		}
+		
+		// clears alignments of bundle but keeps allocated memory
+		void reset(){
+			resize(aset, 0);
+			resize(ascores, 0);
+			
+			seqs.clear();
+			cached.clear();
+			groupIds.clear();
+			groups.clear();
+			groupQuery.clear();
+			groupResults.clear();
+			
+			idxCached = 0;
+			idxGroup  = 0;
+		}
+		
+		// adds read to its group and returns true for first read of group
+		bool addToGroup(const std::string &key){
+			
+			std::pair<std::unordered_map<std::string, unsigned int>::iterator, bool> g;
+			g = groupIds.insert(std::make_pair(key, groupQuery.size()));
+			
+			groups.push_back(g.first->second);
+			
+			if(g.second){
+				groupQuery.push_back(-2);
+				groupResults.push_back(AlignResults<FSeqStr>());
+			}
+			return g.second;
+		}
 	};
 	
 	typedef std::vector<Alignments>    TAlignBundle;
@@ -126,7 +177,8 @@ namespace flexbar{
 		FSeqStr seq;
 		bool rcAdapter;
 		
-		tbb::atomic<unsigned long> rmOverlap, rmFull;
+		// counts of removals, added from thread statistics after processing
+		unsigned long rmOverlap, rmFull;
 		
 		TBar() :
 			rmOverlap(0),
@@ -142,6 +194,13 @@ namespace flexbar{
 	};
 	
 	
+	// adapters with prepended reverse complement of a barcode
+	struct BarcodeAdapters {
+		unsigned int barLength;
+		std::vector<FSeqStr> seqs;
+	};
+	
+	
 	enum AdapterPreset {
 		APOFF,
 		TRUSEQ,
@@ -157,7 +216,8 @@ namespace flexbar{
 		POFF,
 		PON,
 		PSHORT,
-		PONLY
+		PONLY,
+		PINSERT
 	};
 	
 	enum RevCompMode {
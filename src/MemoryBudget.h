@@ -0,0 +1,158 @@
+// MemoryBudget.h
+
+#ifndef FLEXBAR_MEMORYBUDGET_H
+#define FLEXBAR_MEMORYBUDGET_H
+
+
+// Estimates memory of bundles in flight. Reads of a bundle are held from
+// input until output, alignment sets of a bundle hold one alignment for each
+// read and query. With a budget the bundle size is reduced based on the
+// average footprint of loaded reads and their alignment sets. Tokens bound
+// the number of bundles in flight, so the budget holds without waiting.
+class MemoryBudget {
+
+private:
+	
+	const unsigned long m_budget;
+	const unsigned int m_nTokens, m_nQueries;
+	
+	// totals of loaded bundles and last size within budget, updated by
+	// serial input only
+	unsigned long m_nReads, m_nReadBytes, m_bundleSize;
+	
+	std::atomic<unsigned long> m_inFlight, m_peak;
+	
+	// estimates of bundles in flight in input order
+	tbb::concurrent_queue<unsigned long> m_bundleBytes;
+	
+public:
+	
+	MemoryBudget(const Options &o) :
+		
+		m_budget(static_cast<unsigned long>(o.maxMemory) * 1024 * 1024),
+		m_nTokens(o.nTokens),
+		m_nQueries(2 * (o.adapters.size() + o.adapters2.size()) + o.barcodes.size() + o.barcodes2.size()),
+		m_nReads(0),
+		m_nReadBytes(0),
+		m_bundleSize(0),
+		m_inFlight(0),
+		m_peak(0){
+	};
+	
+	
+	// number of (paired) reads for next bundle
+	unsigned int getBundleSize(const unsigned int bundleSize){
+		
+		if(m_budget == 0) return bundleSize;
+		
+		// first bundle of few reads to measure footprint
+		if(m_nReads == 0) return (bundleSize < 64) ? bundleSize : 64;
+		
+		unsigned long readBytes = m_nReadBytes / m_nReads + 1;
+		
+		// each of all tokens may hold a bundle of this size
+		unsigned long size = m_budget / (m_nTokens * (readBytes + getAlignSetBytes()));
+		
+		if(size < 1)          size = 1;
+		if(size > bundleSize) size = bundleSize;
+		
+		m_bundleSize = size;
+		
+		return size;
+	}
+	
+	
+	void addBundle(const flexbar::TPairedReadBundle *prBundle){
+		
+		using namespace flexbar;
+		
+		unsigned long bytes = 0;
+		
+		for(unsigned int i = 0; i < prBundle->size(); ++i){
+			
+			const TPairedRead *pRead = prBundle->at(i);
+			
+			bytes += sizeof(TPairedRead) + getReadBytes(pRead->r1) + getReadBytes(pRead->r2) + getReadBytes(pRead->b);
+		}
+		
+		m_nReads     += prBundle->size();
+		m_nReadBytes += bytes;
+		
+		bytes += prBundle->size() * getAlignSetBytes();
+		
+		m_bundleBytes.push(bytes);
+		
+		unsigned long inFlight = m_inFlight += bytes;
+		unsigned long peak     = m_peak;
+		
+		while(inFlight > peak && ! m_peak.compare_exchange_weak(peak, inFlight));
+	}
+	
+	
+	// called for each bundle after output in input order
+	void releaseBundle(){
+		
+		unsigned long bytes;
+		
+		if(m_bundleBytes.try_pop(bytes)) m_inFlight -= bytes;
+	}
+	
+	
+	void printPeakMemory(std::ostream *out) const {
+		
+		const unsigned long mb = 1024 * 1024;
+		
+		*out << "Peak memory:        " << (getPeakResidentBytes() + mb - 1) / mb << " MB";
+		
+		if(m_budget > 0){
+			*out << "   (bundles in flight " << (m_peak + mb - 1) / mb << " MB";
+			
+			if(m_bundleSize > 0) *out << ", bundle size " << m_bundleSize;
+			
+			*out << ")";
+		}
+		
+		*out << "\n";
+	}
+	
+private:
+	
+	// alignment sets of a read, one alignment of read infix and query for
+	// each query with two rows of array gaps
+	unsigned long getAlignSetBytes() const {
+		
+		using namespace flexbar;
+		
+		typedef seqan::Gaps<TSeqInfix, seqan::ArrayGaps> TGaps;
+		
+		const unsigned long alignBytes = sizeof(TAlign) + sizeof(int) + 2 * (sizeof(TGaps) + sizeof(TSeqInfix) + 4 * sizeof(size_t));
+		
+		return m_nQueries * alignBytes;
+	}
+	
+	
+	unsigned long getReadBytes(const flexbar::TSeqRead *sr) const {
+		
+		if(sr == NULL) return 0;
+		
+		return sizeof(flexbar::TSeqRead) + length(sr->id) + length(sr->seq) + length(sr->qual) + length(sr->umi);
+	}
+	
+	
+	// maximum resident set size of process
+	unsigned long getPeakResidentBytes() const {
+		
+		struct rusage usage;
+		
+		if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+		
+		#ifdef __APPLE__
+			return usage.ru_maxrss;
+		#else
+			return usage.ru_maxrss * 1024;
+		#endif
+	}
+	
+};
+
+#endif
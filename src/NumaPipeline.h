@@ -0,0 +1,155 @@
+// NumaPipeline.h
+
+#ifndef FLEXBAR_NUMAPIPELINE_H
+#define FLEXBAR_NUMAPIPELINE_H
+
+
+// Runs one pipeline replica for each NUMA node in an arena with threads of
+// that node. Replicas take bundles from shared ordered input and hand them
+// to shared ordered output, which writes bundles in input order. Bundles are
+// loaded by threads of the replica and thus allocated in memory of its node.
+// Filters are shared by replicas, statistics are merged after the run.
+template <typename TInput, typename TAlign, typename TOutput>
+class NumaPipeline {
+
+private:
+	
+	// input order and bundle
+	typedef std::pair<unsigned long, flexbar::TPairedReadBundle*> TItem;
+	
+	TInput  &m_input;
+	TAlign  &m_align;
+	TOutput &m_output;
+	
+	const unsigned int m_nThreads, m_nTokens;
+	
+	std::vector<tbb::numa_node_id> m_nodes;
+	
+	std::mutex m_inMutex, m_outMutex;
+	std::condition_variable m_written;
+	
+	unsigned long m_nRead, m_nWritten;
+	bool m_end;
+	
+public:
+	
+	NumaPipeline(const Options &o, TInput &input, TAlign &align, TOutput &output) :
+		
+		m_input(input),
+		m_align(align),
+		m_output(output),
+		m_nThreads(o.nThreads),
+		m_nTokens(o.nTokens),
+		m_nodes(tbb::info::numa_nodes()),
+		m_nRead(0),
+		m_nWritten(0),
+		m_end(false){
+		
+		// each replica gets one thread at least
+		if(m_nodes.size() > m_nThreads) m_nodes.resize(m_nThreads);
+	};
+	
+	
+	// number of replicas, node is unknown without tbbbind library
+	unsigned int getNrReplicas() const {
+		
+		if(m_nodes.size() == 1 && m_nodes[0] == tbb::task_arena::automatic) return 0;
+		
+		return m_nodes.size();
+	}
+	
+	
+	void run(){
+		
+		using namespace tbb;
+		
+		const unsigned int nNodes = m_nodes.size();
+		
+		std::vector<task_arena> arenas(nNodes);
+		std::vector<task_group> groups(nNodes);
+		
+		for(unsigned int i = 0; i < nNodes; ++i){
+			
+			// threads and tokens split evenly, remainder for first nodes
+			int nThreads = m_nThreads / nNodes + (i < m_nThreads % nNodes ? 1 : 0);
+			int nTokens  = m_nTokens  / nNodes + (i < m_nTokens  % nNodes ? 1 : 0);
+			
+			if(nTokens < 1) nTokens = 1;
+			
+			// threads of arena are pinned to node with tbbbind library
+			arenas[i].initialize(task_arena::constraints(m_nodes[i], nThreads), 0);
+			
+			arenas[i].execute([&, i, nTokens]{
+				groups[i].run([&, nTokens]{ runReplica(nTokens); });
+			});
+		}
+		
+		for(unsigned int i = 0; i < nNodes; ++i){
+			arenas[i].execute([&, i]{ groups[i].wait(); });
+		}
+	}
+	
+	
+	void printReplicas(std::ostream *out) const {
+		
+		*out << "NUMA pipelines:     " << m_nodes.size() << "\n";
+	}
+	
+private:
+	
+	void runReplica(const unsigned int nTokens){
+		
+		using namespace tbb;
+		
+		parallel_pipeline(nTokens,
+			make_filter<void, TItem>(filter_mode::serial_in_order,
+				[&](flow_control &fc){ return readBundle(fc); }) &
+			make_filter<TItem, TItem>(filter_mode::parallel,
+				[&](TItem item){ item.second = m_align(item.second); return item; }) &
+			make_filter<TItem, void>(filter_mode::serial_in_order,
+				[&](TItem item){ writeBundle(item); })
+		);
+	}
+	
+	
+	// shared ordered input, stops replica after last bundle
+	TItem readBundle(tbb::flow_control &fc){
+		
+		std::lock_guard<std::mutex> lock(m_inMutex);
+		
+		flexbar::TPairedReadBundle *prBundle = NULL;
+		
+		if(! m_end) prBundle = m_input.getNextBundle();
+		
+		if(prBundle == NULL){
+			m_end = true;
+			fc.stop();
+			
+			return TItem(0, NULL);
+		}
+		
+		return TItem(m_nRead++, prBundle);
+	}
+	
+	
+	// Shared ordered output waits until all earlier bundles are written. The
+	// bundle keeps its token meanwhile, so a fast replica cannot read ahead of
+	// slower ones and bundles in flight of all replicas stay within tokens of
+	// run, which memory budget relies on. Earliest unwritten bundle is never
+	// behind a waiting output of its own replica, as each output is in order.
+	void writeBundle(const TItem &item){
+		
+		std::unique_lock<std::mutex> lock(m_outMutex);
+		
+		m_written.wait(lock, [&]{ return item.first == m_nWritten; });
+		
+		m_output(item.second);
+		
+		++m_nWritten;
+		
+		m_written.notify_all();
+	}
+	
+};
+
+#endif
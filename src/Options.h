@@ -10,6 +10,7 @@
 #include <seqan/arg_parse.h>
 
 #include "FlexbarIO.h"
+#include "ResourceLimits.h"
 
 
 struct Options{
@@ -22,13 +23,13 @@ struct Options{
 	
 	bool isPaired, useAdapterFile, useNumberTag, useRemovalTag, umiTags, logStdout;
 	bool switch2Fasta, writeUnassigned, writeSingleReads, writeSingleReadsP, writeLengthDist;
-	bool useStdin, useStdout, relaxRegion, useRcTrimEnd, qtrimPostRm, addBarcodeAdapter;
-	bool interleavedInput, iupacInput, htrimAdapterRm, htrimMaxFirstOnly;
+	bool useStdin, useStdout, relaxRegion, useRcTrimEnd, qtrimPostRm, addBarcodeAdapter, dedupBundle, numa, autoResources, stageTimes, stageTimesJson, traceBundles, perfCounters;
+	bool interleavedInput, iupacInput, htrimAdapterRm, htrimMaxFirstOnly, alignUngapped, poVerify, poUngapped, rejectShort;
 	
 	int cutLen_begin, cutLen_end, cutLen_read, a_tail_len, b_tail_len, p_min_overlap;
 	int qtrimThresh, qtrimWinSize, a_overhang, htrimMinLength, htrimMinLength2, htrimMaxLength;
-	int maxUncalled, min_readLen, a_min_overlap, b_min_overlap, nThreads, bundleSize, nBundles;
-	int a_match, a_mismatch, a_gapCost, b_match, b_mismatch, b_gapCost, a_cycles;
+	int maxUncalled, min_readLen, a_min_overlap, b_min_overlap, nThreads, nTokens, bundleSize, bundleTime, bundleMin, bundleMax, nBundles, maxMemory;
+	int a_match, a_mismatch, a_gapCost, b_match, b_mismatch, b_gapCost, a_cycles, a_ungappedSample, a_cacheSize;
 	
 	float a_errorRate, b_errorRate, h_errorRate;
 	
@@ -87,9 +88,20 @@ struct Options{
 		relaxRegion       = false;
 		useRcTrimEnd      = false;
 		addBarcodeAdapter = false;
+		dedupBundle       = false;
+		numa              = false;
+		autoResources     = false;
+		stageTimes        = false;
+		stageTimesJson    = false;
+		traceBundles      = false;
+		perfCounters      = false;
 		qtrimPostRm       = false;
 		htrimAdapterRm    = false;
 		htrimMaxFirstOnly = false;
+		alignUngapped     = false;
+		poVerify          = false;
+		poUngapped        = false;
+		rejectShort       = false;
 		
 		cutLen_begin    = 0;
 		cutLen_end      = 0;
@@ -103,6 +115,11 @@ struct Options{
 		htrimMinLength2 = 0;
 		htrimMaxLength  = 0;
 		nBundles        = 0;
+		nTokens         = 0;
+		maxMemory       = 0;
+		bundleTime      = 0;
+		a_ungappedSample = 0;
+		a_cacheSize      = 0;
 		
 		format    = FASTA;
 		qual      = SANGER;
@@ -181,8 +198,16 @@ void defineOptions(seqan::ArgumentParser &parser, const std::string version, con
 	addOption(parser, ArgParseOption("c", "cite", "Show program references for citation."));
 	
 	addSection(parser, "Basic options");
-	addOption(parser, ArgParseOption("n", "threads", "Number of threads to employ.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("n", "threads", "Number of threads to employ. Input and output use extra threads only with several files.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("Na", "auto", "Derive threads, bundles in flight and memory budget from cgroup limits."));
 	addOption(parser, ArgParseOption("N", "bundle", "Number of (paired) reads per thread.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("Nt", "bundle-time", "Adapt bundle size toward target time in ms for alignment of bundle.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("Ni", "bundle-min", "Minimum number of reads per bundle for adaptive size.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("Nx", "bundle-max", "Maximum number of reads per bundle for adaptive size.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("T", "tokens", "Maximum number of bundles in flight. Default: number of threads.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("X", "max-memory", "Memory budget in MB for bundles in flight, reduces bundle size.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("Nu", "numa", "Run one pipeline for each NUMA node with threads of node."));
+	addOption(parser, ArgParseOption("D", "dedup", "Align identical (paired) reads of bundle only once."));
 	addOption(parser, ArgParseOption("M", "bundles", "Process only certain number of bundles for testing.", ARG::INTEGER));
 	addOption(parser, ArgParseOption("t", "target", "Prefix for output file names or paths.", ARG::OUTPUT_PREFIX));
 	addOption(parser, ArgParseOption("r", "reads", "Fasta/q file or stdin (-) with reads that may contain barcodes.", ARG::INPUT_FILE));
@@ -217,12 +242,17 @@ void defineOptions(seqan::ArgumentParser &parser, const std::string version, con
 	addOption(parser, ArgParseOption("ax", "adapter-relaxed", "Skip restriction to pass read ends in right and left modes."));
 	addOption(parser, ArgParseOption("ap", "adapter-pair-overlap", "Overlap detection of paired reads.", ARG::STRING));
 	addOption(parser, ArgParseOption("av", "adapter-min-poverlap", "Minimum overlap of paired reads for detection.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("aq", "adapter-pair-ungapped", "Ungapped overlap detection of paired reads."));
+	addOption(parser, ArgParseOption("aw", "adapter-pair-verify", "Cut pairs in INSERT mode only if overhangs match adapters."));
 	addOption(parser, ArgParseOption("ac", "adapter-revcomp", "Include reverse complements of adapters.", ARG::STRING));
 	addOption(parser, ArgParseOption("ad", "adapter-revcomp-end", "Use different trim-end for reverse complements of adapters.", ARG::STRING));
 	addOption(parser, ArgParseOption("ab", "adapter-add-barcode", "Add reverse complement of detected barcode to adapters."));
 	addOption(parser, ArgParseOption("ar", "adapter-read-set", "Consider only single read set for adapters.", ARG::STRING));
 	addOption(parser, ArgParseOption("ak", "adapter-trimmed-out", "Modify that trimmed reads are kept.", ARG::STRING));
 	addOption(parser, ArgParseOption("ay", "adapter-cycles", "Number of adapter removal cycles.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("az", "adapter-cache", "Number of distinct reads for caching of adapter alignments.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("au", "adapter-ungapped", "Faster adapter detection with ungapped alignments."));
+	addOption(parser, ArgParseOption("aj", "adapter-ungapped-sample", "Number of reads to compare ungapped with gapped detection.", ARG::INTEGER));
 	addOption(parser, ArgParseOption("am", "adapter-match", "Alignment match score.", ARG::INTEGER));
 	addOption(parser, ArgParseOption("ai", "adapter-mismatch", "Alignment mismatch score.", ARG::INTEGER));
 	addOption(parser, ArgParseOption("ag", "adapter-gap", "Alignment gap score.", ARG::INTEGER));
@@ -241,6 +271,7 @@ void defineOptions(seqan::ArgumentParser &parser, const std::string version, con
 	addOption(parser, ArgParseOption("y", "pre-trim-right", "Trim specified number of bases on 3' end prior to detection.", ARG::INTEGER));
 	addOption(parser, ArgParseOption("k", "post-trim-length", "Trim to specified read length from 3' end after removal.", ARG::INTEGER));
 	addOption(parser, ArgParseOption("m", "min-read-length", "Minimum read length to remain after removal.", ARG::INTEGER));
+	addOption(parser, ArgParseOption("mr", "min-read-reject", "Skip homopolymer trimming of reads below min read length."));
 	
 	addSection(parser, "Quality-based trimming");
 	addOption(parser, ArgParseOption("q",  "qtrim", "Quality-based trimming mode.", ARG::STRING));
@@ -273,6 +304,10 @@ void defineOptions(seqan::ArgumentParser &parser, const std::string version, con
 	addOption(parser, ArgParseOption("l", "align-log", "Print chosen read alignments.", ARG::STRING));
 	addOption(parser, ArgParseOption("o", "stdout-log", "Write statistics to stdout instead of target log file."));
 	addOption(parser, ArgParseOption("O", "output-log", "Output file for logging instead of target prefix usage.", ARG::OUTPUT_FILE));
+	addOption(parser, ArgParseOption("Ti", "stage-times", "Print times of pipeline stages and their steps."));
+	addOption(parser, ArgParseOption("Tj", "stage-times-json", "Write times of pipeline stages to json file with target prefix."));
+	addOption(parser, ArgParseOption("Tc", "trace", "Write trace of bundles in chrome trace format with target prefix."));
+	addOption(parser, ArgParseOption("Tp", "perf-counters", "Print hardware counters of stages, if available on system."));
 	addOption(parser, ArgParseOption("g", "removal-tags", "Tag reads that are subject to adapter or barcode removal."));
 	addOption(parser, ArgParseOption("e", "number-tags", "Replace read tags by ascending number to save space."));
 	addOption(parser, ArgParseOption("d", "umi-tags", "Capture UMIs in reads at barcode or adapter N positions."));
@@ -292,18 +327,24 @@ void defineOptions(seqan::ArgumentParser &parser, const std::string version, con
 	setAdvanced(parser, "adapter-tail-length");
 	setAdvanced(parser, "adapter-relaxed");
 	setAdvanced(parser, "adapter-min-poverlap");
+	setAdvanced(parser, "adapter-pair-ungapped");
+	setAdvanced(parser, "adapter-pair-verify");
 	setAdvanced(parser, "adapter-revcomp");
 	setAdvanced(parser, "adapter-revcomp-end");
 	setAdvanced(parser, "adapter-add-barcode");
 	setAdvanced(parser, "adapter-trimmed-out");
 	setAdvanced(parser, "adapter-read-set");
 	setAdvanced(parser, "adapter-cycles");
+	setAdvanced(parser, "adapter-cache");
+	setAdvanced(parser, "adapter-ungapped");
+	setAdvanced(parser, "adapter-ungapped-sample");
 	setAdvanced(parser, "adapter-match");
 	setAdvanced(parser, "adapter-mismatch");
 	setAdvanced(parser, "adapter-gap");
 	// setAdvanced(parser, "adapter-overhang");
 	
 	setAdvanced(parser, "post-trim-length");
+	setAdvanced(parser, "min-read-reject");
 	setAdvanced(parser, "qtrim-win-size");
 	setAdvanced(parser, "qtrim-post-removal");
 	setAdvanced(parser, "htrim-left");
@@ -314,8 +355,16 @@ void defineOptions(seqan::ArgumentParser &parser, const std::string version, con
 	
 	setAdvanced(parser, "version-check");
 	setAdvanced(parser, "man-help");
+	setAdvanced(parser, "auto");
 	setAdvanced(parser, "bundle");
+	setAdvanced(parser, "bundle-time");
+	setAdvanced(parser, "bundle-min");
+	setAdvanced(parser, "bundle-max");
+	setAdvanced(parser, "tokens");
+	setAdvanced(parser, "max-memory");
 	setAdvanced(parser, "bundles");
+	setAdvanced(parser, "numa");
+	setAdvanced(parser, "dedup");
 	setAdvanced(parser, "interleaved");
 	setAdvanced(parser, "iupac");
 	setAdvanced(parser, "length-dist");
@@ -324,6 +373,10 @@ void defineOptions(seqan::ArgumentParser &parser, const std::string version, con
 	setAdvanced(parser, "output-reads");
 	setAdvanced(parser, "output-reads2");
 	setAdvanced(parser, "output-log");
+	setAdvanced(parser, "stage-times");
+	setAdvanced(parser, "stage-times-json");
+	setAdvanced(parser, "trace");
+	setAdvanced(parser, "perf-counters");
 	setAdvanced(parser, "number-tags");
 	setAdvanced(parser, "umi-tags");
 	
@@ -370,13 +423,15 @@ void defineOptions(seqan::ArgumentParser &parser, const std::string version, con
 	setValidValues(parser, "adapter-read-set", "1 2");
 	setValidValues(parser, "adapter-revcomp", "ON ONLY");
 	setValidValues(parser, "adapter-trimmed-out", "OFF ONLY");
-	setValidValues(parser, "adapter-pair-overlap", "ON SHORT ONLY");
+	setValidValues(parser, "adapter-pair-overlap", "ON SHORT ONLY INSERT");
 	setValidValues(parser, "adapter-preset", "TruSeq SmallRNA Methyl Ribo Nextera NexteraMP");
 	
 	// setDefaultValue(parser, "version-check", "OFF");
 	setDefaultValue(parser, "target",  "flexbarOut");
 	setDefaultValue(parser, "threads", "1");
 	setDefaultValue(parser, "bundle",  "256");
+	setDefaultValue(parser, "bundle-min", "16");
+	setDefaultValue(parser, "bundle-max", "16384");
 	
 	setDefaultValue(parser, "max-uncalled",         "0");
 	setDefaultValue(parser, "min-read-length",      "18");
@@ -392,6 +447,8 @@ void defineOptions(seqan::ArgumentParser &parser, const std::string version, con
 	setDefaultValue(parser, "adapter-error-rate",   "0.1");
 	setDefaultValue(parser, "adapter-min-poverlap", "40");
 	setDefaultValue(parser, "adapter-cycles",       "1");
+	setDefaultValue(parser, "adapter-cache",        "0");
+	setDefaultValue(parser, "adapter-ungapped-sample", "10000");
 	setDefaultValue(parser, "adapter-match",        "1");
 	setDefaultValue(parser, "adapter-mismatch",     "-1");
 	setDefaultValue(parser, "adapter-gap",          "-6");
@@ -548,7 +605,31 @@ void loadOptions(Options &o, seqan::ArgumentParser &parser){
 	
 	// basic options
 	
+	// threads and memory limit in bytes of cgroup with auto resources
+	unsigned int autoThreads = 0;
+	unsigned long autoMemory = 0;
+	
+	if(isSet(parser, "auto")){
+		o.autoResources = true;
+		
+		ResourceLimits limits;
+		
+		autoThreads = limits.getNrThreads();
+		autoMemory  = limits.getMemoryLimit();
+		
+		*out << "CPUs of process:       " << limits.getNrCpus() << endl;
+		
+		if(limits.getCpuQuota() > 0) *out << "CPU quota of cgroup:   " << limits.getCpuQuota() << " cores" << endl;
+		else                         *out << "CPU quota of cgroup:   none" << endl;
+		
+		if(limits.getMemoryLimit() > 0) *out << "Memory limit:          " << limits.getMemoryLimit() / (1024 * 1024) << " MB" << endl;
+		else                            *out << "Memory limit:          none" << endl;
+	}
+	
 	getOptionValue(o.nThreads, parser, "threads");
+	
+	if(o.autoResources && ! isSet(parser, "threads")) o.nThreads = autoThreads;
+	
 	*out << "Number of threads:     " << o.nThreads << endl;
 	
 	if(o.nThreads < 1){
@@ -556,6 +637,24 @@ void loadOptions(Options &o, seqan::ArgumentParser &parser){
 		exit(1);
 	}
 	
+	o.nTokens = o.nThreads;
+	
+	if(isSet(parser, "tokens")){
+		getOptionValue(o.nTokens, parser, "tokens");
+		*out << "Bundles in flight:     " << o.nTokens << endl;
+		
+		if(o.nTokens < 1){
+			cerr << "\n" << "Number of bundles in flight should be 1 at least.\n" << endl;
+			exit(1);
+		}
+	}
+	else if(o.autoResources){
+		
+		// serial stages of bundles overlap with alignment
+		o.nTokens = 2 * o.nThreads;
+		*out << "Bundles in flight:     " << o.nTokens << endl;
+	}
+	
 	getOptionValue(o.bundleSize, parser, "bundle");
 	*out << "Bundled fragments:     " << o.bundleSize << endl;
 	
@@ -564,6 +663,57 @@ void loadOptions(Options &o, seqan::ArgumentParser &parser){
 		exit(1);
 	}
 	
+	getOptionValue(o.bundleMin, parser, "bundle-min");
+	getOptionValue(o.bundleMax, parser, "bundle-max");
+	
+	if(isSet(parser, "bundle-time")){
+		getOptionValue(o.bundleTime, parser, "bundle-time");
+		*out << "Adaptive bundle time:  " << o.bundleTime << " ms" << endl;
+		*out << "Bundle size range:     " << o.bundleMin << "-" << o.bundleMax << endl;
+		
+		if(o.bundleTime < 1){
+			cerr << "\n" << "Bundle time should be 1 ms at least.\n" << endl;
+			exit(1);
+		}
+		
+		if(o.bundleMin < 1 || o.bundleMax < o.bundleMin){
+			cerr << "\n" << "Bundle size range should be positive and not empty.\n" << endl;
+			exit(1);
+		}
+		
+		if(o.bundleSize < o.bundleMin) o.bundleSize = o.bundleMin;
+		if(o.bundleSize > o.bundleMax) o.bundleSize = o.bundleMax;
+	}
+	
+	if(isSet(parser, "max-memory")){
+		getOptionValue(o.maxMemory, parser, "max-memory");
+		*out << "Memory budget:         " << o.maxMemory << " MB" << endl;
+		
+		if(o.maxMemory < 1){
+			cerr << "\n" << "Memory budget should be 1 MB at least.\n" << endl;
+			exit(1);
+		}
+	}
+	else if(o.autoResources && autoMemory > 0){
+		
+		// remaining memory for adapters, alignment matrices and file buffers
+		o.maxMemory = autoMemory / (4 * 1024 * 1024);
+		
+		if(o.maxMemory < 1) o.maxMemory = 1;
+		
+		*out << "Memory budget:         " << o.maxMemory << " MB" << endl;
+	}
+	
+	if(isSet(parser, "numa")){
+		*out << "NUMA pipelines:        on" << endl;
+		o.numa = true;
+	}
+	
+	if(isSet(parser, "dedup")){
+		*out << "Bundle deduplication:  on" << endl;
+		o.dedupBundle = true;
+	}
+	
 	if(isSet(parser, "bundles")){
 		getOptionValue(o.nBundles, parser, "bundles");
 		*out << "Number of bundles:     " << o.nBundles << endl << endl;
@@ -745,6 +895,11 @@ void loadOptions(Options &o, seqan::ArgumentParser &parser){
 		exit(1);
 	}
 	
+	if(isSet(parser, "min-read-reject")){
+		o.rejectShort = true;
+		*out << "min-read-reject:       on" << endl;
+	}
+	
 	if(o.cutLen_read != 0 && o.cutLen_read < o.min_readLen){
 		o.cutLen_read = 0;
 		cerr << "\nOption post-trim-length omitted, as it is shorter than min read length.\n" << endl;
@@ -910,6 +1065,11 @@ void loadOptions(Options &o, seqan::ArgumentParser &parser){
 	if(isSet(parser, "removal-tags")) o.useRemovalTag   = true;
 	if(isSet(parser, "umi-tags"))     o.umiTags         = true;
 	
+	if(isSet(parser, "stage-times"))      o.stageTimes     = true;
+	if(isSet(parser, "stage-times-json")) o.stageTimesJson = true;
+	if(isSet(parser, "trace"))            o.traceBundles   = true;
+	if(isSet(parser, "perf-counters"))    o.perfCounters   = true;
+	
 	*out << endl;
 	
 	
@@ -982,9 +1142,10 @@ void loadOptions(Options &o, seqan::ArgumentParser &parser){
 		string pOverlap;
 		getOptionValue(pOverlap, parser, "adapter-pair-overlap");
 		
-		if     (pOverlap == "ON")    o.poMode = PON;
-		else if(pOverlap == "SHORT") o.poMode = PSHORT;
-		else if(pOverlap == "ONLY")  o.poMode = PONLY;
+		if     (pOverlap == "ON")     o.poMode = PON;
+		else if(pOverlap == "SHORT")  o.poMode = PSHORT;
+		else if(pOverlap == "ONLY")   o.poMode = PONLY;
+		else if(pOverlap == "INSERT") o.poMode = PINSERT;
 		else {
 			cerr << "\nSpecified pair overlap mode is unknown.\n" << endl;
 			exit(1);
@@ -993,7 +1154,7 @@ void loadOptions(Options &o, seqan::ArgumentParser &parser){
 		else *out << "adapter-pair-overlap:  " << pOverlap << endl;
 	}
 	
-	if(o.adapRm != AOFF || o.poMode == PONLY){
+	if(o.adapRm != AOFF || o.poMode == PONLY || o.poMode == PINSERT){
 		
 		if(o.adapRm != AOFF){
 			
@@ -1091,6 +1252,25 @@ void loadOptions(Options &o, seqan::ArgumentParser &parser){
 			if(o.aPreset == NEXTERAMP && o.a_cycles < 3) o.a_cycles = 3;
 			if(o.a_cycles > 1) *out << "adapter-cycles:        " << o.a_cycles << endl;
 			
+			getOptionValue(o.a_cacheSize, parser, "adapter-cache");
+			
+			if(o.a_cacheSize < 0){
+				cerr << "\nNumber of cached adapter alignments should be 0 at least.\n" << endl;
+				exit(1);
+			}
+			if(o.a_cacheSize > 0) *out << "adapter-cache:         " << o.a_cacheSize << endl;
+			
+			if(isSet(parser, "adapter-ungapped")){
+				getOptionValue(o.a_ungappedSample, parser, "adapter-ungapped-sample");
+				
+				if(o.a_ungappedSample < 0){
+					cerr << "\nSample size for ungapped adapter detection should be 0 at least.\n" << endl;
+					exit(1);
+				}
+				*out << "adapter-ungapped:      on   (sample " << o.a_ungappedSample << ")" << endl;
+				o.alignUngapped = true;
+			}
+			
 			getOptionValue(o.a_min_overlap, parser, "adapter-min-overlap");
 			*out << "adapter-min-overlap:   " << o.a_min_overlap << endl;
 			
@@ -1099,9 +1279,9 @@ void loadOptions(Options &o, seqan::ArgumentParser &parser){
 				exit(1);
 			}
 			
-			if((o.poMode == PON || o.poMode == PSHORT) && o.a_end != RIGHT && o.a_end != RTAIL &&
+			if((o.poMode == PON || o.poMode == PSHORT || o.poMode == PINSERT) && o.a_end != RIGHT && o.a_end != RTAIL &&
 				(! o.useRcTrimEnd || (o.arc_end != RIGHT && o.arc_end != RTAIL))){
-				cerr << "\nOne adapter trim-end should be RIGHT or RTAIL if pair overlap is ON or SHORT.\n" << endl;
+				cerr << "\nOne adapter trim-end should be RIGHT or RTAIL if pair overlap is ON, SHORT or INSERT.\n" << endl;
 				exit(1);
 			}
 			
@@ -1113,6 +1293,16 @@ void loadOptions(Options &o, seqan::ArgumentParser &parser){
 			getOptionValue(o.p_min_overlap, parser, "adapter-min-poverlap");
 			*out << "adapter-min-poverlap:  " << o.p_min_overlap << endl;
 			
+			if(isSet(parser, "adapter-pair-ungapped")){
+				*out << "adapter-pair-ungapped: on" << endl;
+				o.poUngapped = true;
+			}
+			
+			if(o.poMode == PINSERT && o.adapRm != AOFF && isSet(parser, "adapter-pair-verify")){
+				*out << "adapter-pair-verify:   on" << endl;
+				o.poVerify = true;
+			}
+			
 			if(o.p_min_overlap < 20){
 				cerr << "\nMinimum overlap of paired reads should be 20 at least.\n" << endl;
 				exit(1);
@@ -6,23 +6,29 @@
 #include "SeqAlign.h"
 #include "SeqAlignPair.h"
 #include "SeqAlignAlgo.h"
+#include "SeqAlignAlgoUngapped.h"
 
 
 template <typename TSeqStr, typename TString>
-class PairedAlign : public tbb::filter {
+class PairedAlign {
 
 private:
 	
 	const bool m_writeUnassigned, m_twoBarcodes, m_umiTags, m_useRcTrimEnd;
-	const bool m_htrim, m_htrimAdapterRm, m_htrimMaxFirstOnly, m_addBarcodeAdapter;
+	const bool m_htrim, m_htrimAdapterRm, m_htrimMaxFirstOnly, m_addBarcodeAdapter, m_ungapped, m_rejectShort;
 	
 	const std::string m_htrimLeft, m_htrimRight;
 	
 	const unsigned int m_htrimMinLength, m_htrimMinLength2, m_htrimMaxLength;
 	const unsigned int m_arTimes;
+	const int m_minLength;
+	const unsigned long m_sampleSize;
 	
 	const float m_htrimErrorRate;
 	
+	// allowed mismatches of homopolymers for each length
+	std::vector<unsigned int> m_htrimMaxErrors;
+	
 	const flexbar::FileFormat     m_format;
 	const flexbar::LogAlign       m_log;
 	const flexbar::RunType        m_runType;
@@ -31,23 +37,87 @@ private:
 	const flexbar::TrimEnd        m_aTrimEnd, m_arcTrimEnd, m_bTrimEnd;
 	const flexbar::PairOverlap    m_poMode;
 	
-	tbb::atomic<unsigned long> m_unassigned;
+	unsigned long m_unassigned, m_nSampleReads, m_nSampleDiffs;
+	std::atomic<unsigned long> m_nSampled;
 	tbb::concurrent_vector<flexbar::TBar> *m_adapters, *m_adapters2;
 	tbb::concurrent_vector<flexbar::TBar> *m_barcodes, *m_barcodes2;
 	
+	// adapter queries of each barcode for reads and mates
+	std::vector<flexbar::BarcodeAdapters> m_barAdapters, m_barAdapters2;
+	
 	typedef SeqAlign<TSeqStr, TString, SeqAlignAlgo<TSeqStr> > TSeqAlign;
 	TSeqAlign *m_a1, *m_b1, *m_a2, *m_b2;
 	
+	typedef SeqAlign<TSeqStr, TString, SeqAlignAlgoUngapped<TSeqStr> > TSeqAlignUngapped;
+	TSeqAlignUngapped *m_u1, *m_u2;
+	
+	// gapped alignment of sampled reads for comparison with ungapped detection
+	tbb::concurrent_vector<flexbar::TBar> m_sAdapters, m_sAdapters2;
+	TSeqAlign *m_s1, *m_s2;
+	
 	typedef SeqAlignPair<TSeqStr, TString, SeqAlignAlgo<TSeqStr> > TSeqAlignPair;
 	TSeqAlignPair *m_p;
 	
+	// alignments of thread that are reused for each bundle
+	struct AlignWorkspace {
+		
+		flexbar::TAlignBundle barcodes, adapters;
+		flexbar::Alignments pairs;
+		
+		std::vector<unsigned int> idxAl;
+		std::vector<flexbar::ComputeCycle> cycle;
+		
+		AlignWorkspace() :
+			barcodes(3),
+			adapters(4),
+			idxAl(4, 0),
+			cycle(4, flexbar::PRELOAD){
+		}
+	};
+	
+	tbb::enumerable_thread_specific<AlignWorkspace> m_workspaces;
+	
+	// read counts of thread, merged once after processing
+	struct ReadStats {
+		
+		unsigned long unassigned, sampleReads, sampleDiffs;
+		
+		ReadStats() :
+			unassigned(0),
+			sampleReads(0),
+			sampleDiffs(0){
+		}
+	};
+	
+	tbb::enumerable_thread_specific<ReadStats> m_stats;
+	
+	// reads of pair to align in adapter cycle, removals found in cycle and
+	// reads to align to rc adapters again after removal of adapter
+	struct CycleState {
+		
+		bool align1, align2, found1, found2, realign1, realign2;
+		
+		CycleState() :
+			align1(true),
+			align2(true),
+			found1(false),
+			found2(false),
+			realign1(false),
+			realign2(false){
+		}
+	};
+	
+	AlignLog *m_alignLog;
+	BundleTuner *m_tuner;
+	StageBalance *m_balance;
+	StageTimers *m_timers;
+	PerfCounters *m_perf;
 	std::ostream *out;
 	
 public:
 	
-	PairedAlign(Options &o) :
+	PairedAlign(Options &o, AlignLog *alignLog, BundleTuner *tuner, StageBalance *balance, StageTimers *timers, PerfCounters *perf) :
 		
-		filter(parallel),
 		m_format(o.format),
 		m_log(o.logAlign),
 		m_runType(o.runType),
@@ -58,6 +128,10 @@ public:
 		m_arcTrimEnd(o.arc_end),
 		m_bTrimEnd(o.b_end),
 		m_arTimes(o.a_cycles),
+		m_minLength(o.min_readLen),
+		m_rejectShort(o.rejectShort),
+		m_ungapped(o.alignUngapped),
+		m_sampleSize(o.alignUngapped ? o.a_ungappedSample : 0),
 		m_umiTags(o.umiTags),
 		m_useRcTrimEnd(o.useRcTrimEnd),
 		m_writeUnassigned(o.writeUnassigned),
@@ -72,21 +146,45 @@ public:
 		m_htrimAdapterRm(o.htrimAdapterRm),
 		m_htrim(o.htrimLeft != "" || o.htrimRight != ""),
 		m_twoBarcodes(o.barDetect == flexbar::WITHIN_READ_REMOVAL2 || o.barDetect == flexbar::WITHIN_READ2),
+		m_alignLog(alignLog),
+		m_tuner(tuner),
+		m_balance(balance),
+		m_timers(timers),
+		m_perf(perf),
 		out(o.out),
-		m_unassigned(0){
+		m_unassigned(0),
+		m_nSampled(0),
+		m_nSampleReads(0),
+		m_nSampleDiffs(0){
 		
 		m_barcodes  = &o.barcodes;
 		m_adapters  = &o.adapters;
 		m_barcodes2 = &o.barcodes2;
 		m_adapters2 = &o.adapters2;
 		
-		m_b1 = new TSeqAlign(m_barcodes,  o, o.b_min_overlap, o.b_errorRate, o.b_tail_len, o.b_match, o.b_mismatch, o.b_gapCost, true);
-		m_b2 = new TSeqAlign(m_barcodes2, o, o.b_min_overlap, o.b_errorRate, o.b_tail_len, o.b_match, o.b_mismatch, o.b_gapCost, true);
+		m_b1 = new TSeqAlign(m_barcodes,  o, alignLog, perf, o.b_min_overlap, o.b_errorRate, o.b_tail_len, o.b_match, o.b_mismatch, o.b_gapCost, true);
+		m_b2 = new TSeqAlign(m_barcodes2, o, alignLog, perf, o.b_min_overlap, o.b_errorRate, o.b_tail_len, o.b_match, o.b_mismatch, o.b_gapCost, true);
+		
+		m_a1 = new TSeqAlign(m_adapters,  o, alignLog, perf, o.a_min_overlap, o.a_errorRate, o.a_tail_len, o.a_match, o.a_mismatch, o.a_gapCost, false);
+		m_a2 = new TSeqAlign(m_adapters2, o, alignLog, perf, o.a_min_overlap, o.a_errorRate, o.a_tail_len, o.a_match, o.a_mismatch, o.a_gapCost, false);
+		
+		m_u1 = new TSeqAlignUngapped(m_adapters,  o, alignLog, perf, o.a_min_overlap, o.a_errorRate, o.a_tail_len, o.a_match, o.a_mismatch, o.a_gapCost, false);
+		m_u2 = new TSeqAlignUngapped(m_adapters2, o, alignLog, perf, o.a_min_overlap, o.a_errorRate, o.a_tail_len, o.a_match, o.a_mismatch, o.a_gapCost, false);
+		
+		m_sAdapters  = o.adapters;
+		m_sAdapters2 = o.adapters2;
+		
+		m_s1 = new TSeqAlign(&m_sAdapters,  o, alignLog, perf, o.a_min_overlap, o.a_errorRate, o.a_tail_len, o.a_match, o.a_mismatch, o.a_gapCost, false, false);
+		m_s2 = new TSeqAlign(&m_sAdapters2, o, alignLog, perf, o.a_min_overlap, o.a_errorRate, o.a_tail_len, o.a_match, o.a_mismatch, o.a_gapCost, false, false);
 		
-		m_a1 = new TSeqAlign(m_adapters,  o, o.a_min_overlap, o.a_errorRate, o.a_tail_len, o.a_match, o.a_mismatch, o.a_gapCost, false);
-		m_a2 = new TSeqAlign(m_adapters2, o, o.a_min_overlap, o.a_errorRate, o.a_tail_len, o.a_match, o.a_mismatch, o.a_gapCost, false);
+		m_htrimMaxErrors = getHtrimMaxErrors(flexbar::MAX_READLENGTH);
 		
-		m_p  = new TSeqAlignPair(o, o.p_min_overlap, o.a_errorRate, o.a_match, o.a_mismatch, o.a_gapCost);
+		m_p  = new TSeqAlignPair(m_adapters, m_adapters2, o, alignLog, perf, o.p_min_overlap, o.a_errorRate, o.a_match, o.a_mismatch, o.a_gapCost);
+		
+		if(m_addBarcodeAdapter){
+			setBarcodeAdapters(m_barAdapters,  m_barcodes2, m_adapters);
+			setBarcodeAdapters(m_barAdapters2, m_barcodes,  (m_adapRem != flexbar::NORMAL2) ? m_adapters : m_adapters2);
+		}
 		
 		if(m_log == flexbar::TAB)
 		*out << "ReadTag\tQueryTag\tQueryStart\tQueryEnd\tOverlapLength\tMismatches\tIndels\tAllowedErrors" << std::endl;
@@ -98,6 +196,10 @@ public:
 		delete m_b2;
 		delete m_a1;
 		delete m_a2;
+		delete m_u1;
+		delete m_u2;
+		delete m_s1;
+		delete m_s2;
 		delete m_p;
 	};
 	
@@ -107,69 +209,276 @@ public:
 		using namespace flexbar;
 		
 		switch(m_barType){
-			case BARCODE_READ:         pRead->barID  = m_b1->alignSeqRead(pRead->b,  false, alBundle[0], cycle[0], idxAl[0], alMode, m_bTrimEnd, ""); break;
-			case WITHIN_READ_REMOVAL2: pRead->barID2 = m_b2->alignSeqRead(pRead->r2, true,  alBundle[2], cycle[2], idxAl[2], alMode, m_bTrimEnd, "");
-			case WITHIN_READ_REMOVAL:  pRead->barID  = m_b1->alignSeqRead(pRead->r1, true,  alBundle[1], cycle[1], idxAl[1], alMode, m_bTrimEnd, ""); break;
-			case WITHIN_READ2:         pRead->barID2 = m_b2->alignSeqRead(pRead->r2, false, alBundle[2], cycle[2], idxAl[2], alMode, m_bTrimEnd, "");
-			case WITHIN_READ:          pRead->barID  = m_b1->alignSeqRead(pRead->r1, false, alBundle[1], cycle[1], idxAl[1], alMode, m_bTrimEnd, ""); break;
+			case BARCODE_READ:         pRead->barID  = m_b1->alignSeqRead(pRead->b,  false, alBundle[0], cycle[0], idxAl[0], alMode, m_bTrimEnd, NULL); break;
+			case WITHIN_READ_REMOVAL2: pRead->barID2 = m_b2->alignSeqRead(pRead->r2, true,  alBundle[2], cycle[2], idxAl[2], alMode, m_bTrimEnd, NULL);
+			case WITHIN_READ_REMOVAL:  pRead->barID  = m_b1->alignSeqRead(pRead->r1, true,  alBundle[1], cycle[1], idxAl[1], alMode, m_bTrimEnd, NULL); break;
+			case WITHIN_READ2:         pRead->barID2 = m_b2->alignSeqRead(pRead->r2, false, alBundle[2], cycle[2], idxAl[2], alMode, m_bTrimEnd, NULL);
+			case WITHIN_READ:          pRead->barID  = m_b1->alignSeqRead(pRead->r1, false, alBundle[1], cycle[1], idxAl[1], alMode, m_bTrimEnd, NULL); break;
 			case BOFF: break;
 		}
 		
 		if(pRead->barID == 0 || (m_twoBarcodes && pRead->barID2 == 0)){
 			
-			if(cycle[0] != PRELOAD) m_unassigned++;
+			if(cycle[0] != PRELOAD) m_stats.local().unassigned++;
 		}
 	}
 	
 	
-	void alignPairedReadToAdapters(flexbar::TPairedRead* pRead, flexbar::TAlignBundle &alBundle, std::vector<flexbar::ComputeCycle> &cycle, std::vector<unsigned int> &idxAl, const flexbar::AlignmentMode &alMode, const flexbar::TrimEnd trimEnd){
+	// Prepends reverse complement of each barcode to all adapters. Umi positions
+	// of barcodes remain N and act as wildcards in alignment.
+	void setBarcodeAdapters(std::vector<flexbar::BarcodeAdapters> &barAdapters, tbb::concurrent_vector<flexbar::TBar> *barcodes, tbb::concurrent_vector<flexbar::TBar> *adapters){
 		
 		using namespace flexbar;
 		
-		if(m_adapRem != ATWO){
+		for(unsigned int b = 0; b < barcodes->size(); ++b){
 			
-			TSeqStr addBarcode = "";
+			TSeqStr rcBarcode = barcodes->at(b).seq;
+			seqan::reverseComplement(rcBarcode);
 			
-			if(m_addBarcodeAdapter && pRead->r2 != NULL && pRead->barID2 > 0){
-				addBarcode = m_barcodes2->at(pRead->barID2 - 1).seq;
-				
-				if(m_umiTags && pRead->r2->umi != ""){
-					unsigned int umiPos = 1;
-					
-					for(unsigned int i = 0; i < length(addBarcode); ++i){
-						if(addBarcode[i] == 'N' && length(pRead->r2->umi) > umiPos){
-							addBarcode[i] = pRead->r2->umi[umiPos++];
-						}
-					}
-				}
-				seqan::reverseComplement(addBarcode);
+			BarcodeAdapters ba;
+			ba.barLength = length(rcBarcode);
+			
+			for(unsigned int i = 0; i < adapters->size(); ++i){
+				ba.seqs.push_back(rcBarcode);
+				append(ba.seqs.back(), adapters->at(i).seq);
 			}
+			barAdapters.push_back(ba);
+		}
+	}
+	
+	
+	// adapter queries with barcode of other mate if barcode was detected
+	flexbar::BarcodeAdapters* getBarcodeAdapters(std::vector<flexbar::BarcodeAdapters> &barAdapters, const unsigned int barID, flexbar::TSeqRead *mate){
+		
+		if(m_addBarcodeAdapter && mate != NULL && barID > 0) return &barAdapters.at(barID - 1);
+		
+		return NULL;
+	}
+	
+	
+	// Alignments of read m use index m of bundle. With ALIGNRCOFF both adapter
+	// orientations are aligned in one pass, rc adapters at index m + 2. The rc
+	// result is only applied if the read is not trimmed by adapter before.
+	template <typename TAligner>
+	void alignReadToAdapters(TAligner *a, flexbar::TSeqRead *sr, flexbar::BarcodeAdapters *barAdapters, const unsigned int m, flexbar::TAlignBundle &alBundle, std::vector<flexbar::ComputeCycle> &cycle, std::vector<unsigned int> &idxAl, const flexbar::AlignmentMode &alMode, const flexbar::TrimEnd trimEnd, bool &found, bool &realignRC){
+		
+		using namespace flexbar;
+		
+		if(alMode != ALIGNRCOFF){
+			if(a->alignSeqRead(sr, true, alBundle[m], cycle[m], idxAl[m], alMode, trimEnd, barAdapters) > 0) found = true;
 			
-			m_a1->alignSeqRead(pRead->r1, true, alBundle[0], cycle[0], idxAl[0], alMode, trimEnd, addBarcode);
+			return;
 		}
 		
+		AlignResults<TSeqStr> am, amRC;
+		
+		int qIndex   = a->findAlignment(am,   sr, alBundle[m],     cycle[m],     idxAl[m],     ALIGNRCOFF, trimEnd,      barAdapters);
+		int qIndexRC = a->findAlignment(amRC, sr, alBundle[m + 2], cycle[m + 2], idxAl[m + 2], ALIGNRC,    m_arcTrimEnd, barAdapters);
+		
+		if(cycle[m] == PRELOAD) return;
+		
+		if(a->applyAlignment(sr, true, qIndex, am, trimEnd) > 0){
+			found     = true;
+			realignRC = true;
+		}
+		else if(a->applyAlignment(sr, true, qIndexRC, amRC, m_arcTrimEnd) > 0) found = true;
+	}
+	
+	
+	template <typename TAligner>
+	void alignPairedReadToAdapters(TAligner *a1, TAligner *a2, flexbar::TPairedRead* pRead, flexbar::TAlignBundle &alBundle, std::vector<flexbar::ComputeCycle> &cycle, std::vector<unsigned int> &idxAl, const flexbar::AlignmentMode &alMode, const flexbar::TrimEnd trimEnd, CycleState &state){
+		
+		using namespace flexbar;
+		
+		// pairs trimmed based on insert need no adapter alignment
+		if(m_poMode == PINSERT && pRead->r2 != NULL && (pRead->r1->poRemoval || pRead->r2->poRemoval)) return;
+		
+		// rc adapter pass only for reads trimmed by adapter in combined pass
+		const bool align1 = (alMode == ALIGNRC) ? state.realign1 : state.align1;
+		const bool align2 = (alMode == ALIGNRC) ? state.realign2 : state.align2;
+		
+		if(m_adapRem != ATWO && align1){
+			
+			BarcodeAdapters *barAdapters = getBarcodeAdapters(m_barAdapters, pRead->barID2, pRead->r2);
+			
+			alignReadToAdapters(a1, pRead->r1, barAdapters, 0, alBundle, cycle, idxAl, alMode, trimEnd, state.found1, state.realign1);
+		}
+		else if(m_adapRem != ATWO) countSkippedRead(a1, pRead->r1, cycle[0], alMode);
+		
 		if(pRead->r2 != NULL && m_adapRem != AONE){
 			
-			TSeqStr addBarcode = "";
+			TAligner *a = (m_adapRem != NORMAL2) ? a1 : a2;
 			
-			if(m_addBarcodeAdapter && pRead->barID > 0){
-				addBarcode = m_barcodes->at(pRead->barID - 1).seq;
+			if(align2){
+				BarcodeAdapters *barAdapters = getBarcodeAdapters(m_barAdapters2, pRead->barID, pRead->r1);
 				
-				if(m_umiTags && pRead->r1->umi != ""){
-					unsigned int umiPos = 1;
+				alignReadToAdapters(a, pRead->r2, barAdapters, 1, alBundle, cycle, idxAl, alMode, trimEnd, state.found2, state.realign2);
+			}
+			else countSkippedRead(a, pRead->r2, cycle[1], alMode);
+		}
+	}
+	
+	
+	// Read unchanged in previous cycle is skipped, but counted as short prior
+	// to removal like an aligned read, once for each adapter orientation. The
+	// rc pass counts nothing, its reads are counted in the combined pass.
+	template <typename TAligner>
+	void countSkippedRead(TAligner *a, flexbar::TSeqRead *sr, const flexbar::ComputeCycle cycle, const flexbar::AlignmentMode &alMode){
+		
+		using namespace flexbar;
+		
+		if(cycle == PRELOAD || alMode == ALIGNRC) return;
+		
+		a->addSkippedRead(sr);
+		
+		if(alMode == ALIGNRCOFF) a->addSkippedRead(sr);
+	}
+	
+	
+	template <typename TAligner>
+	void alignBundleToAdapters(TAligner *a1, TAligner *a2, flexbar::TPairedReadBundle *prBundle, std::vector<CycleState> &states, const flexbar::AlignmentMode alMode, const flexbar::TrimEnd trimEnd){
+		
+		using namespace flexbar;
+		
+		AlignWorkspace &ws = m_workspaces.local();
+		
+		TAlignBundle &alBundle           = ws.adapters;
+		std::vector<unsigned int> &idxAl = ws.idxAl;
+		std::vector<ComputeCycle> &cycle = ws.cycle;
+		
+		for(unsigned int i = 0; i < 4; ++i){
+			alBundle[i].reset();
+			idxAl[i] = 0;
+			cycle[i] = PRELOAD;
+		}
+		for(unsigned int i = 0; i < prBundle->size(); ++i){
+			alignPairedReadToAdapters(a1, a2, prBundle->at(i), alBundle, cycle, idxAl, alMode, trimEnd, states[i]);
+		}
+		
+		for(unsigned int i = 0; i < 4; ++i){
+			idxAl[i] = 0;
+			cycle[i] = COMPUTE;
+		}
+		for(unsigned int i = 0; i < prBundle->size(); ++i){
+			alignPairedReadToAdapters(a1, a2, prBundle->at(i), alBundle, cycle, idxAl, alMode, trimEnd, states[i]);
+		}
+	}
+	
+	
+	template <typename TAligner>
+	void removeAdapters(TAligner *a1, TAligner *a2, flexbar::TPairedReadBundle *prBundle){
+		
+		using namespace flexbar;
+		
+		// reads without removal in a cycle stay unchanged and are skipped in
+		// later cycles, unless all alignments are logged
+		std::vector<CycleState> states(prBundle->size());
+		
+		for(unsigned int c = 0; c < m_arTimes; ++c){
+			
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			
+			if(m_useRcTrimEnd){
+				alignBundleToAdapters(a1, a2, prBundle, states, ALIGNRCOFF, m_aTrimEnd);
+				alignBundleToAdapters(a1, a2, prBundle, states, ALIGNRC,    m_arcTrimEnd);
+			}
+			else alignBundleToAdapters(a1, a2, prBundle, states, ALIGNALL, m_aTrimEnd);
+			
+			m_timers->addSpan("align_adapter_cycle", start, prBundle->size(), prBundle);
+			
+			if(c + 1 < m_arTimes){
+				for(unsigned int i = 0; i < states.size(); ++i){
 					
-					for(unsigned int i = 0; i < length(addBarcode); ++i){
-						if(addBarcode[i] == 'N' && length(pRead->r1->umi) > umiPos){
-							addBarcode[i] = pRead->r1->umi[umiPos++];
-						}
+					if(m_log != ALL){
+						states[i].align1 = states[i].found1;
+						states[i].align2 = states[i].found2;
 					}
+					states[i].found1   = false;
+					states[i].found2   = false;
+					states[i].realign1 = false;
+					states[i].realign2 = false;
 				}
-				seqan::reverseComplement(addBarcode);
 			}
+		}
+	}
+	
+	
+	// copies first reads of bundle until sample size is reached
+	flexbar::TPairedReadBundle* copySampleReads(flexbar::TPairedReadBundle *prBundle){
+		
+		using namespace flexbar;
+		
+		if(m_nSampled >= m_sampleSize) return NULL;
+		
+		unsigned long first = m_nSampled.fetch_add(prBundle->size());
+		
+		if(first >= m_sampleSize) return NULL;
+		
+		unsigned long nReads = std::min<unsigned long>(prBundle->size(), m_sampleSize - first);
+		
+		TPairedReadBundle *sample = new TPairedReadBundle();
+		sample->reserve(nReads);
+		
+		for(unsigned int i = 0; i < nReads; ++i){
+			
+			TPairedRead *pRead = prBundle->at(i);
+			
+			TSeqRead *r1 = new TSeqRead(*pRead->r1);
+			TSeqRead *r2 = NULL;
+			
+			if(pRead->r2 != NULL) r2 = new TSeqRead(*pRead->r2);
+			
+			TPairedRead *sRead = new TPairedRead(r1, r2, NULL);
+			
+			sRead->barID  = pRead->barID;
+			sRead->barID2 = pRead->barID2;
+			
+			sample->push_back(sRead);
+		}
+		return sample;
+	}
+	
+	
+	void compareSampleReads(flexbar::TPairedReadBundle *prBundle, flexbar::TPairedReadBundle *sample){
+		
+		using namespace flexbar;
+		
+		ReadStats &stats = m_stats.local();
+		
+		for(unsigned int i = 0; i < sample->size(); ++i){
+			
+			TPairedRead *pRead = prBundle->at(i);
+			TPairedRead *sRead = sample->at(i);
 			
-			if(m_adapRem != NORMAL2) m_a1->alignSeqRead(pRead->r2, true, alBundle[1], cycle[1], idxAl[1], alMode, trimEnd, addBarcode);
-			else                     m_a2->alignSeqRead(pRead->r2, true, alBundle[1], cycle[1], idxAl[1], alMode, trimEnd, addBarcode);
+			stats.sampleReads++;
+			if(pRead->r1->seq != sRead->r1->seq) stats.sampleDiffs++;
+			
+			if(pRead->r2 != NULL){
+				stats.sampleReads++;
+				if(pRead->r2->seq != sRead->r2->seq) stats.sampleDiffs++;
+			}
+			delete sRead;
+		}
+		delete sample;
+	}
+	
+	
+	// Reads below min length are discarded in output regardless of further
+	// trimming, homopolymer trimming of these reads is skipped on request.
+	bool isRejected(const flexbar::TSeqRead *seqRead) const {
+		return m_rejectShort && length(seqRead->seq) < m_minLength;
+	}
+	
+	
+	// error threshold of float rate as integer for homopolymers up to maxLength
+	std::vector<unsigned int> getHtrimMaxErrors(const unsigned int maxLength){
+		
+		std::vector<unsigned int> maxErrors(maxLength + 1);
+		
+		for(unsigned int i = 0; i <= maxLength; ++i){
+			maxErrors[i] = static_cast<unsigned int>(m_htrimErrorRate * i);
 		}
+		return maxErrors;
 	}
 	
 	
@@ -178,6 +487,8 @@ public:
 		using namespace std;
 		using namespace flexbar;
 		
+		if(isRejected(seqRead)) return;
+		
 		if(m_htrimAdapterRm && m_useRcTrimEnd){
 			if     (seqRead->rmAdapter   && (m_aTrimEnd   == RIGHT || m_aTrimEnd   == RTAIL)) return;
 			else if(seqRead->rmAdapterRC && (m_arcTrimEnd == RIGHT || m_arcTrimEnd == RTAIL)) return;
@@ -186,37 +497,40 @@ public:
 			if(m_aTrimEnd == RIGHT || m_aTrimEnd == RTAIL) return;
 		}
 		
-		if(! m_htrimAdapterRm || seqRead->rmAdapter || seqRead->rmAdapterRC){
+		unsigned int seqLen = length(seqRead->seq);
+		
+		if(seqLen > 0 && (! m_htrimAdapterRm || seqRead->rmAdapter || seqRead->rmAdapterRC)){
+			
+			vector<unsigned int> longRead;
+			if(seqLen >= m_htrimMaxErrors.size()) longRead = getHtrimMaxErrors(seqLen);
+			
+			const unsigned int *maxErrors = longRead.empty() ? &m_htrimMaxErrors[0] : &longRead[0];
+			const unsigned char *seq      = rawSeq(seqRead->seq);
+			
+			// homopolymers are trimmed by moving start of read
+			unsigned int offset = 0;
 			
 			for(unsigned int s = 0; s < m_htrimLeft.length(); ++s){
 				
-				char nuc = m_htrimLeft[s];
+				unsigned char nuc = seqan::ordValue(seqan::Dna5(m_htrimLeft[s]));
 				
-				unsigned int cutPos = 0;
-				unsigned int notNuc = 0;
+				unsigned int limit = seqLen - offset;
 				
-				for(unsigned int i = 0; i < length(seqRead->seq); ++i){
-					
-					if(seqRead->seq[i] != nuc){
-						notNuc++;
-					}
-					else if(notNuc <= m_htrimErrorRate * (i+1)){
-						
-						if(m_htrimMaxLength != 0 && i+1 > m_htrimMaxLength && (! m_htrimMaxFirstOnly || s == 0)) break;
-						
-						cutPos = i+1;
-					}
-				}
+				if(m_htrimMaxLength != 0 && limit > m_htrimMaxLength && (! m_htrimMaxFirstOnly || s == 0)) limit = m_htrimMaxLength;
+				
+				unsigned int cutPos = homopolymerPrefix(seq + offset, limit, nuc, maxErrors);
 				
 				unsigned int htrimMinLength = m_htrimMinLength;
 				if(m_htrimMinLength2 > 0 && s > 0) htrimMinLength = m_htrimMinLength2;
 				
-				if(cutPos > 0 && cutPos >= htrimMinLength){
-					erase(seqRead->seq, 0, cutPos);
-					
-					if(m_format == FASTQ){
-						erase(seqRead->qual, 0, cutPos);
-					}
+				if(cutPos > 0 && cutPos >= htrimMinLength) offset += cutPos;
+			}
+			
+			if(offset > 0){
+				erase(seqRead->seq, 0, offset);
+				
+				if(m_format == FASTQ){
+					erase(seqRead->qual, 0, offset);
 				}
 			}
 		}
@@ -228,6 +542,8 @@ public:
 		using namespace std;
 		using namespace flexbar;
 		
+		if(isRejected(seqRead)) return;
+		
 		if(m_htrimAdapterRm && m_useRcTrimEnd){
 			if     (seqRead->rmAdapter   && (m_aTrimEnd   == LEFT || m_aTrimEnd   == LTAIL)) return;
 			else if(seqRead->rmAdapterRC && (m_arcTrimEnd == LEFT || m_arcTrimEnd == LTAIL)) return;
@@ -236,52 +552,57 @@ public:
 			if(m_aTrimEnd == LEFT || m_aTrimEnd == LTAIL) return;
 		}
 		
-		if(! m_htrimAdapterRm || seqRead->rmAdapter || seqRead->rmAdapterRC){
+		unsigned int seqLen = length(seqRead->seq);
+		
+		if(seqLen > 0 && (! m_htrimAdapterRm || seqRead->rmAdapter || seqRead->rmAdapterRC)){
+			
+			vector<unsigned int> longRead;
+			if(seqLen >= m_htrimMaxErrors.size()) longRead = getHtrimMaxErrors(seqLen);
+			
+			const unsigned int *maxErrors = longRead.empty() ? &m_htrimMaxErrors[0] : &longRead[0];
+			const unsigned char *seq      = rawSeq(seqRead->seq);
+			
+			// homopolymers are trimmed by moving end of read
+			unsigned int end = seqLen;
 			
 			for(unsigned int s = 0; s < m_htrimRight.length(); ++s){
 				
-				char nuc = m_htrimRight[s];
+				unsigned char nuc = seqan::ordValue(seqan::Dna5(m_htrimRight[s]));
 				
-				unsigned int seqLen = length(seqRead->seq);
-				unsigned int cutPos = seqLen;
-				unsigned int notNuc = 0;
+				unsigned int limit = end;
 				
-				for(int i = seqLen - 1; i >= 0; --i){
-					
-					if(seqRead->seq[i] != nuc){
-						notNuc++;
-					}
-					else if(notNuc <= m_htrimErrorRate * (seqLen - i)){
-						
-						if(m_htrimMaxLength != 0 && i < seqLen - m_htrimMaxLength && (! m_htrimMaxFirstOnly || s == 0)) break;
-						
-						cutPos = i;
-					}
-				}
+				// reads shorter than max length remain untrimmed
+				if(m_htrimMaxLength != 0 && (! m_htrimMaxFirstOnly || s == 0)) limit = (end >= m_htrimMaxLength) ? m_htrimMaxLength : 0;
+				
+				unsigned int cutPos = end - homopolymerSuffix(seq, end, limit, nuc, maxErrors);
 				
 				unsigned int htrimMinLength = m_htrimMinLength;
 				if(m_htrimMinLength2 > 0 && s > 0) htrimMinLength = m_htrimMinLength2;
 				
-				if(cutPos < seqLen && cutPos <= seqLen - htrimMinLength){
-					erase(seqRead->seq, cutPos, length(seqRead->seq));
-					
-					if(m_format == FASTQ){
-						erase(seqRead->qual, cutPos, length(seqRead->qual));
-					}
+				if(cutPos < end && cutPos <= end - htrimMinLength) end = cutPos;
+			}
+			
+			if(end < seqLen){
+				erase(seqRead->seq, end, seqLen);
+				
+				if(m_format == FASTQ){
+					erase(seqRead->qual, end, length(seqRead->qual));
 				}
 			}
 		}
 	}
 	
 	
-	// tbb filter operator
-	void* operator()(void* item){
+	// parallel filter of pipeline
+	flexbar::TPairedReadBundle* operator()(flexbar::TPairedReadBundle *prBundle){
 		
 		using namespace flexbar;
 		
-		if(item != NULL){
+		if(prBundle != NULL){
 			
-			TPairedReadBundle *prBundle = static_cast<TPairedReadBundle* >(item);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			
+			PerfCounters::Sample counts = m_perf->begin();
 			
 			if(m_umiTags){
 				for(unsigned int i = 0; i < prBundle->size(); ++i){
@@ -298,19 +619,18 @@ public:
 			
 			if(m_barType != BOFF){
 				
-				TAlignBundle alBundle;
-				Alignments r1AlignmentsB, r2AlignmentsB, bAlignmentsB;
+				std::chrono::steady_clock::time_point stepStart = std::chrono::steady_clock::now();
 				
-				alBundle.push_back(bAlignmentsB);
-				alBundle.push_back(r1AlignmentsB);
-				alBundle.push_back(r2AlignmentsB);
+				AlignWorkspace &ws = m_workspaces.local();
 				
-				std::vector<unsigned int> idxAl;
-				std::vector<ComputeCycle> cycle;
+				TAlignBundle &alBundle           = ws.barcodes;
+				std::vector<unsigned int> &idxAl = ws.idxAl;
+				std::vector<ComputeCycle> &cycle = ws.cycle;
 				
 				for(unsigned int i = 0; i < 3; ++i){
-					idxAl.push_back(0);
-					cycle.push_back(PRELOAD);
+					alBundle[i].reset();
+					idxAl[i] = 0;
+					cycle[i] = PRELOAD;
 				}
 				for(unsigned int i = 0; i < prBundle->size(); ++i){
 					alignPairedReadToBarcodes(prBundle->at(i), alBundle, cycle, idxAl, alMode);
@@ -323,13 +643,19 @@ public:
 				for(unsigned int i = 0; i < prBundle->size(); ++i){
 					alignPairedReadToBarcodes(prBundle->at(i), alBundle, cycle, idxAl, alMode);
 				}
+				
+				m_timers->addTime(StageTimers::ALIGN_BARCODES, stepStart, prBundle->size(), prBundle);
 			}
 			
 			// adapter removal
 			
 			if(m_poMode != POFF){
 				
-				Alignments alignments;
+				std::chrono::steady_clock::time_point stepStart = std::chrono::steady_clock::now();
+				
+				Alignments &alignments = m_workspaces.local().pairs;
+				alignments.reset();
+				
 				unsigned int idxAl = 0;
 				ComputeCycle cycle = PRELOAD;
 				
@@ -343,53 +669,27 @@ public:
 				for(unsigned int i = 0; i < prBundle->size(); ++i){
 					m_p->alignSeqReadPair(prBundle->at(i)->r1, prBundle->at(i)->r2, alignments, cycle, idxAl);
 				}
+				
+				m_timers->addTime(StageTimers::ALIGN_PAIRS, stepStart, prBundle->size(), prBundle);
 			}
 			
 			if(m_adapRem != AOFF){
 				
-				for(unsigned int c = 0; c < m_arTimes; ++c){
+				std::chrono::steady_clock::time_point stepStart = std::chrono::steady_clock::now();
+				
+				if(m_ungapped){
+					TPairedReadBundle *sample = copySampleReads(prBundle);
 					
-					flexbar::TrimEnd trimEnd = m_aTrimEnd;
-					unsigned int rc = 1;
+					removeAdapters(m_u1, m_u2, prBundle);
 					
-					if(m_useRcTrimEnd){
-						alMode = ALIGNRCOFF;
-						rc = 2;
-					}
-					
-					for(unsigned int r = 0; r < rc; ++r){
-						
-						if(m_useRcTrimEnd && r == 1){
-							alMode  = ALIGNRC;
-							trimEnd = m_arcTrimEnd;
-						}
-						
-						TAlignBundle alBundle;
-						Alignments r1AlignmentsA, r2AlignmentsA;
-						
-						alBundle.push_back(r1AlignmentsA);
-						alBundle.push_back(r2AlignmentsA);
-						
-						std::vector<unsigned int> idxAl;
-						std::vector<ComputeCycle> cycle;
-						
-						for(unsigned int i = 0; i < 2; ++i){
-							idxAl.push_back(0);
-							cycle.push_back(PRELOAD);
-						}
-						for(unsigned int i = 0; i < prBundle->size(); ++i){
-							alignPairedReadToAdapters(prBundle->at(i), alBundle, cycle, idxAl, alMode, trimEnd);
-						}
-						
-						for(unsigned int i = 0; i < 2; ++i){
-							idxAl[i] = 0;
-							cycle[i] = COMPUTE;
-						}
-						for(unsigned int i = 0; i < prBundle->size(); ++i){
-							alignPairedReadToAdapters(prBundle->at(i), alBundle, cycle, idxAl, alMode, trimEnd);
-						}
+					if(sample != NULL){
+						removeAdapters(m_s1, m_s2, sample);
+						compareSampleReads(prBundle, sample);
 					}
 				}
+				else removeAdapters(m_a1, m_a2, prBundle);
+				
+				m_timers->addTime(StageTimers::ALIGN_ADAPTERS, stepStart, prBundle->size(), prBundle);
 			}
 			
 			if(m_umiTags){
@@ -405,6 +705,9 @@ public:
 			}
 			
 			if(m_htrim){
+				
+				std::chrono::steady_clock::time_point stepStart = std::chrono::steady_clock::now();
+				
 				if(m_htrimLeft != ""){
 					for(unsigned int i = 0; i < prBundle->size(); ++i){
 						trimLeftHPS(prBundle->at(i)->r1);
@@ -421,14 +724,47 @@ public:
 						trimRightHPS(prBundle->at(i)->r2);
 					}
 				}
+				
+				m_timers->addTime(StageTimers::ALIGN_HTRIM, stepStart, prBundle->size(), prBundle);
 			}
 			
+			m_alignLog->commit(prBundle);
+			m_tuner->addBundleTime(prBundle->size(), start);
+			m_balance->addTime(StageBalance::ALIGN, start);
+			m_timers->addTime(StageTimers::ALIGN, start, prBundle->size(), prBundle);
+			m_perf->end(PerfCounters::ALIGN, counts, prBundle->size());
+			
 			return prBundle;
 		}
 		else return NULL;
 	}
 	
 	
+	// adds statistics of all threads, to be called after processing
+	void mergeStatistics(){
+		
+		typedef typename tbb::enumerable_thread_specific<ReadStats>::iterator TStatsIter;
+		
+		for(TStatsIter it = m_stats.begin(); it != m_stats.end(); ++it){
+			m_unassigned   += it->unassigned;
+			m_nSampleReads += it->sampleReads;
+			m_nSampleDiffs += it->sampleDiffs;
+		}
+		
+		m_stats.clear();
+		
+		m_b1->mergeStats();
+		m_b2->mergeStats();
+		m_a1->mergeStats();
+		m_a2->mergeStats();
+		m_u1->mergeStats();
+		m_u2->mergeStats();
+		m_s1->mergeStats();
+		m_s2->mergeStats();
+		m_p->mergeStats();
+	}
+	
+	
 	unsigned long getNrUnassignedReads() const {
 		
 		using namespace flexbar;
@@ -442,9 +778,14 @@ public:
 		
 		using namespace flexbar;
 		
-		if     (m_poMode  != POFF)    return m_p->getNrPreShortReads();
-		else if(m_adapRem != NORMAL2) return m_a1->getNrPreShortReads();
-		else                          return m_a1->getNrPreShortReads() + m_a2->getNrPreShortReads();
+		if(m_poMode != POFF) return m_p->getNrPreShortReads();
+		
+		unsigned long nShort = m_ungapped ? m_u1->getNrPreShortReads() : m_a1->getNrPreShortReads();
+		
+		if(m_adapRem == NORMAL2)
+			nShort += m_ungapped ? m_u2->getNrPreShortReads() : m_a2->getNrPreShortReads();
+		
+		return nShort;
 	}
 	
 	
@@ -463,21 +804,42 @@ public:
 		
 		using namespace flexbar;
 		
-		if(m_a1->getNrModifiedReads() > 0)
+		if(m_ungapped){
+			if(m_u1->getNrModifiedReads() > 0)
+				*out << m_u1->getOverlapStatsString() << "\n\n";
+		}
+		else if(m_a1->getNrModifiedReads() > 0)
 			*out << m_a1->getOverlapStatsString() << "\n\n";
 		
-		if(m_adapRem != NORMAL2) *out << std::endl;
+		if(m_adapRem != NORMAL2){
+			printUngappedSampleStats();
+			*out << std::endl;
+		}
 	}
 	
 	
 	void printAdapterOverlapStats2(){
 		
-		if(m_a2->getNrModifiedReads() > 0)
+		if(m_ungapped){
+			if(m_u2->getNrModifiedReads() > 0)
+				*out << m_u2->getOverlapStatsString() << "\n\n";
+		}
+		else if(m_a2->getNrModifiedReads() > 0)
 			*out << m_a2->getOverlapStatsString() << "\n\n";
 		
+		printUngappedSampleStats();
 		*out << std::endl;
 	}
 	
+	
+	void printUngappedSampleStats(){
+		
+		if(m_ungapped && m_nSampleReads > 0){
+			*out << "Ungapped detection differs from gapped alignment for ";
+			*out << m_nSampleDiffs << " of " << m_nSampleReads << " sampled reads.\n\n";
+		}
+	}
+	
 };
 
 #endif
@@ -7,43 +7,52 @@
 
 
 template <typename TSeqStr, typename TString>
-class PairedInput : public tbb::filter {
+class PairedInput {
 
 private:
 	
 	const flexbar::FileFormat m_format;
 	const bool m_isPaired, m_useBarRead, m_useNumberTag, m_interleaved;
-	const unsigned int m_bundleSize;
 	
-	tbb::atomic<unsigned long> m_uncalled, m_uncalledPairs, m_tagCounter, m_nBundles;
+	std::atomic<unsigned long> m_uncalled, m_uncalledPairs, m_tagCounter, m_nBundles;
 	SeqInput<TSeqStr, TString> *m_f1, *m_f2, *m_b;
+	BundleTuner *m_tuner;
+	MemoryBudget *m_memory;
+	StageBalance *m_balance;
+	StageTimers *m_timers;
+	PerfCounters *m_perf;
 	
 public:
 	
-	PairedInput(const Options &o) :
+	PairedInput(const Options &o, BundleTuner *tuner, MemoryBudget *memory, StageBalance *balance, StageTimers *timers, PerfCounters *perf) :
 		
-		filter(serial_in_order),
 		m_format(o.format),
 		m_useNumberTag(o.useNumberTag),
 		m_interleaved(o.interleavedInput),
 		m_isPaired(o.isPaired),
 		m_useBarRead(o.barDetect == flexbar::BARCODE_READ),
-		m_bundleSize(o.bundleSize),
 		m_nBundles(o.nBundles),
 		m_tagCounter(0),
 		m_uncalled(0),
-		m_uncalledPairs(0){
+		m_uncalledPairs(0),
+		m_tuner(tuner),
+		m_memory(memory),
+		m_balance(balance),
+		m_timers(timers),
+		m_perf(perf){
 		
-		m_f1 = new SeqInput<TSeqStr, TString>(o, o.readsFile, true, o.useStdin);
+		m_f1 = new SeqInput<TSeqStr, TString>(o, o.readsFile, true, o.useStdin, timers);
 		
 		m_f2 = NULL;
 		m_b  = NULL;
 		
 		if(m_isPaired && ! m_interleaved)
-		m_f2 = new SeqInput<TSeqStr, TString>(o, o.readsFile2, true, false);
+		m_f2 = new SeqInput<TSeqStr, TString>(o, o.readsFile2, true, false, timers);
 		
 		if(m_useBarRead)
-		m_b = new SeqInput<TSeqStr, TString>(o, o.barReadsFile, false, false);
+		m_b = new SeqInput<TSeqStr, TString>(o, o.barReadsFile, false, false, timers);
+		
+		m_balance->setNrStreams(StageBalance::INPUT, 1 + (m_f2 != NULL) + (m_b != NULL));
 		
 		if(m_nBundles > 0) ++m_nBundles;
 	}
@@ -69,27 +78,48 @@ public:
 			if(m_nBundles-- == 1) return NULL;
 		}
 		
-		unsigned int bundleSize      = m_bundleSize;
-		if(m_interleaved) bundleSize = m_bundleSize * 2;
+		// adaptive bundle size may be reduced by memory budget
+		const unsigned int nPairs = m_memory->getBundleSize(m_tuner->getBundleSize());
+		
+		unsigned int bundleSize      = nPairs;
+		if(m_interleaved) bundleSize = nPairs * 2;
+		
+		unsigned int nReads = 0, nReads2 = 0, nBarReads = 0;
 		
-		unsigned int nReads = m_f1->loadSeqReads(uncalled, ids, seqs, quals, bundleSize);
+		const bool loadMates = m_isPaired && ! m_interleaved;
+		
+		// files of mates and barcode reads are decoded in parallel tasks
+		if(m_balance->isParallel(StageBalance::INPUT) && (loadMates || m_useBarRead)){
+			
+			tbb::this_task_arena::isolate([&]{
+				
+				tbb::task_group tasks;
+				
+				if(loadMates)    tasks.run([&]{ nReads2   = m_f2->loadSeqReads(uncalled2,  ids2,  seqs2,  quals2,  nPairs); });
+				if(m_useBarRead) tasks.run([&]{ nBarReads = m_b->loadSeqReads(uncalledBR, idsBR, seqsBR, qualsBR, nPairs); });
+				
+				nReads = m_f1->loadSeqReads(uncalled, ids, seqs, quals, bundleSize);
+				
+				tasks.wait();
+			});
+		}
+		else{
+			                 nReads    = m_f1->loadSeqReads(uncalled,   ids,   seqs,   quals,   bundleSize);
+			if(loadMates)    nReads2   = m_f2->loadSeqReads(uncalled2,  ids2,  seqs2,  quals2,  nPairs);
+			if(m_useBarRead) nBarReads = m_b->loadSeqReads(uncalledBR, idsBR, seqsBR, qualsBR, nPairs);
+		}
 		
 		if(m_interleaved && nReads % 2 == 1){
 			cerr << "\nERROR: Interleaved reads input does not contain even number of reads.\n" << endl;
 			exit(1);
 		}
 		
-		if(m_isPaired && ! m_interleaved){
-			unsigned int nReads2 = m_f2->loadSeqReads(uncalled2, ids2, seqs2, quals2, m_bundleSize);
-			
-			if(nReads != nReads2){
-				cerr << "\nERROR: Read without counterpart in paired input mode.\n" << endl;
-				exit(1);
-			}
+		if(loadMates && nReads != nReads2){
+			cerr << "\nERROR: Read without counterpart in paired input mode.\n" << endl;
+			exit(1);
 		}
 		
 		if(m_useBarRead){
-			unsigned int nBarReads = m_b->loadSeqReads(uncalledBR, idsBR, seqsBR, qualsBR, m_bundleSize);
 			
 			unsigned int multi      = 1;
 			if(m_interleaved) multi = 2;
@@ -206,11 +236,17 @@ public:
 	}
 	
 	
-	// tbb filter operator
-	void* operator()(void*){
+	// next non-empty bundle of input, NULL after last bundle
+	flexbar::TPairedReadBundle* getNextBundle(){
 		
 		using namespace flexbar;
 		
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		
+		m_timers->addTokenWait(start);
+		
+		PerfCounters::Sample counts = m_perf->begin();
+		
 		TPairedReadBundle *prBundle = NULL;
 		
 		prBundle = static_cast< TPairedReadBundle* >(loadPairedReadBundle());
@@ -223,16 +259,28 @@ public:
 				
 				prBundle = static_cast< TPairedReadBundle* >(loadPairedReadBundle());
 				
-				if(prBundle == NULL) return prBundle;
+				if(prBundle == NULL) break;
 			}
 		}
 		
+		if(prBundle != NULL) m_memory->addBundle(prBundle);
+		
+		m_balance->addTime(StageBalance::INPUT, start);
+		m_timers->addTime(StageTimers::INPUT, start, prBundle != NULL ? prBundle->size() : 0, prBundle);
+		m_perf->end(PerfCounters::INPUT, counts, prBundle != NULL ? prBundle->size() : 0);
+		
 		return prBundle;
 	}
 	
-	// virtual
-	void finalize(void* item){
+	
+	// serial input filter of pipeline, stops pipeline after last bundle
+	flexbar::TPairedReadBundle* operator()(tbb::flow_control &fc){
 		
+		flexbar::TPairedReadBundle *prBundle = getNextBundle();
+		
+		if(prBundle == NULL) fc.stop();
+		
+		return prBundle;
 	}
 	
 	
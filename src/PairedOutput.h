@@ -9,16 +9,16 @@
 
 
 template <typename TSeqStr, typename TString>
-class PairedOutput : public tbb::filter {
+class PairedOutput {
 
 private:
 	
 	int m_mapsize;
 	const int m_minLength, m_qtrimThresh, m_qtrimWinSize;
 	const bool m_isPaired, m_writeUnassigned, m_writeSingleReads, m_writeSingleReadsP;
-	const bool m_twoBarcodes, m_qtrimPostRm;
+	const bool m_twoBarcodes, m_qtrimPostRm, m_useStdout;
 	
-	tbb::atomic<unsigned long> m_nSingleReads, m_nLowPhred;
+	std::atomic<unsigned long> m_nSingleReads, m_nLowPhred;
 	
 	const std::string m_target;
 	
@@ -32,16 +32,25 @@ private:
 	typedef SeqOutputFiles<TSeqStr, TString> TOutFiles;
 	
 	TOutFiles *m_outMap;
+	AlignLog *m_alignLog;
+	MemoryBudget *m_memory;
+	StageBalance *m_balance;
+	StageTimers *m_timers;
+	PerfCounters *m_perf;
 	std::ostream *out;
 	
+	// reads of bundle for each output file if files are encoded in parallel
+	typedef std::map<TSeqOutput*, std::vector<flexbar::TSeqRead*> > TFileReads;
+	TFileReads m_fileReads;
+	bool m_parallel;
+	
 	tbb::concurrent_vector<flexbar::TBar> *m_adapters,  *m_barcodes;
 	tbb::concurrent_vector<flexbar::TBar> *m_adapters2, *m_barcodes2;
 	
 public:
 	
-	PairedOutput(Options &o) :
+	PairedOutput(Options &o, AlignLog *alignLog, MemoryBudget *memory, StageBalance *balance, StageTimers *timers, PerfCounters *perf) :
 		
-		filter(serial_in_order),
 		m_target(o.targetName),
 		m_format(o.format),
 		m_runType(o.runType),
@@ -57,6 +66,13 @@ public:
 		m_writeSingleReads(o.writeSingleReads),
 		m_writeSingleReadsP(o.writeSingleReadsP),
 		m_twoBarcodes(o.barDetect == flexbar::WITHIN_READ_REMOVAL2 || o.barDetect == flexbar::WITHIN_READ2),
+		m_alignLog(alignLog),
+		m_memory(memory),
+		m_balance(balance),
+		m_timers(timers),
+		m_perf(perf),
+		m_useStdout(o.useStdout),
+		m_parallel(false),
 		out(o.out){
 		
 		using namespace std;
@@ -229,6 +245,15 @@ public:
 				}
 			}
 		}
+		
+		// files are encoded in parallel tasks, not with standard output
+		unsigned int nFiles = 0;
+		
+		for(unsigned int i = 0; i < m_mapsize; ++i){
+			nFiles += (m_outMap[i].f1 != NULL) + (m_outMap[i].f2 != NULL) + (m_outMap[i].single1 != NULL) + (m_outMap[i].single2 != NULL);
+		}
+		
+		m_balance->setNrStreams(StageBalance::OUTPUT, m_useStdout ? 1 : nFiles);
 	}
 	
 	
@@ -237,6 +262,33 @@ public:
 	};
 	
 	
+	// writes read to file or defers it for parallel encoding of files
+	void writeRead(TSeqOutput *file, flexbar::TSeqRead *read){
+		
+		if(m_parallel) m_fileReads[file].push_back(read);
+		else           file->writeRead(read);
+	}
+	
+	
+	// encodes output files of bundle in parallel tasks, order of reads
+	// within each file is kept
+	void writeFileReads(){
+		
+		typedef typename TFileReads::value_type TFile;
+		
+		tbb::this_task_arena::isolate([&]{
+			
+			tbb::parallel_for_each(m_fileReads.begin(), m_fileReads.end(), [](TFile &file){
+				
+				for(unsigned int i = 0; i < file.second.size(); ++i)
+					file.first->writeRead(file.second[i]);
+			});
+		});
+		
+		m_fileReads.clear();
+	}
+	
+	
 	void writePairedRead(flexbar::TPairedRead* pRead){
 		
 		using namespace flexbar;
@@ -261,7 +313,7 @@ public:
 						if     (m_aTrimmed == ATOFF  &&  (pRead->r1->rmAdapter ||   pRead->r1->rmAdapterRC)) r1ok = false;
 						else if(m_aTrimmed == ATONLY && ! pRead->r1->rmAdapter && ! pRead->r1->rmAdapterRC)  r1ok = false;
 						
-						if(r1ok) m_outMap[pRead->barID].f1->writeRead(pRead->r1);
+						if(r1ok) writeRead(m_outMap[pRead->barID].f1, pRead->r1);
 					}
 				}
 				break;
@@ -301,14 +353,14 @@ public:
 						else if(m_aTrimmed == ATONLY && ! pRead->r2->rmAdapter && ! pRead->r2->rmAdapterRC && ! pRead->r2->poRemoval)  r2ok = false;
 						
 						if(r1ok && r2ok){
-							m_outMap[outIdx].f1->writeRead(pRead->r1);
-							m_outMap[outIdx].f2->writeRead(pRead->r2);
+							writeRead(m_outMap[outIdx].f1, pRead->r1);
+							writeRead(m_outMap[outIdx].f2, pRead->r2);
 						}
 						else if(r1ok && ! r2ok){
 							m_nSingleReads++;
 							
 							if(m_writeSingleReads){
-								m_outMap[outIdx].single1->writeRead(pRead->r1);
+								writeRead(m_outMap[outIdx].single1, pRead->r1);
 							}
 							else if(m_writeSingleReadsP){
 								
@@ -317,15 +369,15 @@ public:
 								if(m_format == FASTQ)
 								pRead->r2->qual = prefix(pRead->r1->qual, 1);
 								
-								m_outMap[outIdx].f1->writeRead(pRead->r1);
-								m_outMap[outIdx].f2->writeRead(pRead->r2);
+								writeRead(m_outMap[outIdx].f1, pRead->r1);
+								writeRead(m_outMap[outIdx].f2, pRead->r2);
 							}
 						}
 						else if(! r1ok && r2ok){
 							m_nSingleReads++;
 							
 							if(m_writeSingleReads){
-								m_outMap[outIdx].single2->writeRead(pRead->r2);
+								writeRead(m_outMap[outIdx].single2, pRead->r2);
 							}
 							else if(m_writeSingleReadsP){
 								
@@ -334,8 +386,8 @@ public:
 								if(m_format == FASTQ)
 								pRead->r1->qual = prefix(pRead->r2->qual, 1);
 								
-								m_outMap[outIdx].f1->writeRead(pRead->r1);
-								m_outMap[outIdx].f2->writeRead(pRead->r2);
+								writeRead(m_outMap[outIdx].f1, pRead->r1);
+								writeRead(m_outMap[outIdx].f2, pRead->r2);
 							}
 						}
 					}
@@ -345,24 +397,47 @@ public:
 	}
 	
 	
-	// tbb filter operator
-	void* operator()(void* item){
+	// serial output filter of pipeline, deletes bundle
+	void operator()(flexbar::TPairedReadBundle *prBundle){
 		
 		using namespace flexbar;
 		
-		if(item != NULL){
+		if(prBundle != NULL){
+			
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			
+			PerfCounters::Sample counts = m_perf->begin();
+			
+			m_alignLog->write(prBundle);
 			
-			TPairedReadBundle *prBundle = static_cast< TPairedReadBundle* >(item);
+			m_timers->addTime(StageTimers::OUTPUT_LOG, start, 0, prBundle);
+			
+			std::chrono::steady_clock::time_point stepStart = std::chrono::steady_clock::now();
+			
+			m_parallel = ! m_useStdout && m_balance->isParallel(StageBalance::OUTPUT);
 			
 			for(unsigned int i = 0; i < prBundle->size(); ++i){
-				
 				writePairedRead(prBundle->at(i));
+			}
+			
+			if(m_parallel) writeFileReads();
+			
+			m_timers->addTime(StageTimers::OUTPUT_READS, stepStart, prBundle->size(), prBundle);
+			
+			const unsigned int nReads = prBundle->size();
+			
+			for(unsigned int i = 0; i < prBundle->size(); ++i){
 				delete prBundle->at(i);
 			}
 			delete prBundle;
+			
+			m_memory->releaseBundle();
+			m_balance->addTime(StageBalance::OUTPUT, start);
+			
+			// deleted bundle is not traced, address may be taken by input
+			m_timers->addTime(StageTimers::OUTPUT, start, nReads);
+			m_perf->end(PerfCounters::OUTPUT, counts, nReads);
 		}
-		
-		return NULL;
 	}
 	
 	
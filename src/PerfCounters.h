@@ -0,0 +1,347 @@
+// PerfCounters.h
+
+#ifndef FLEXBAR_PERFCOUNTERS_H
+#define FLEXBAR_PERFCOUNTERS_H
+
+#include <cstring>
+#include <cerrno>
+#include <iomanip>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+
+// Hardware counters of pipeline stages and of batches of global alignment,
+// read with perf_event_open. Each thread opens its own counters on first use
+// as one group that counts the thread on any CPU in user space. Counters of
+// a group are scheduled together, so ratios like IPC refer to same windows.
+// Counts are scaled by time enabled and running if the kernel multiplexes
+// the group with other events. Counters that cannot be opened, e.g. without
+// permission or in virtual machines, are left out.
+class PerfCounters {
+
+public:
+	
+	enum Stage {
+		INPUT,
+		ALIGN,
+		ALIGN_DP,
+		OUTPUT,
+		NSTAGES
+	};
+	
+	enum Counter {
+		CYCLES,
+		INSTRUCTIONS,
+		CACHE_MISSES,
+		BRANCH_MISSES,
+		NCOUNTERS
+	};
+	
+	struct Sample {
+		unsigned long value[NCOUNTERS], enabled, running;
+	};
+	
+private:
+	
+	// counters of thread, copies start unopened
+	struct ThreadCounters {
+		
+		// first opened counter leads group, values of group in open order
+		int fd[NCOUNTERS], pos[NCOUNTERS], leader;
+		unsigned int nOpened;
+		bool opened;
+		
+		unsigned long total[NSTAGES][NCOUNTERS], reads[NSTAGES], enabled[NSTAGES], running[NSTAGES];
+		
+		ThreadCounters(){
+			init();
+		}
+		
+		ThreadCounters(const ThreadCounters &){
+			init();
+		}
+		
+		~ThreadCounters(){
+			#ifdef __linux__
+				for(unsigned int i = 0; i < NCOUNTERS; ++i){
+					if(fd[i] >= 0) close(fd[i]);
+				}
+			#endif
+		}
+		
+		void init(){
+			leader  = -1;
+			nOpened = 0;
+			opened  = false;
+			
+			for(unsigned int i = 0; i < NCOUNTERS; ++i){
+				fd[i]  = -1;
+				pos[i] = -1;
+			}
+			
+			for(unsigned int s = 0; s < NSTAGES; ++s){
+				reads[s]   = 0;
+				enabled[s] = 0;
+				running[s] = 0;
+				
+				for(unsigned int i = 0; i < NCOUNTERS; ++i) total[s][i] = 0;
+			}
+		}
+	};
+	
+	typedef tbb::enumerable_thread_specific<ThreadCounters> TThreadCounters;
+	
+	const bool m_enabled;
+	
+	TThreadCounters m_counters;
+	
+	// counters opened by any thread and first error
+	std::atomic<bool> m_available[NCOUNTERS];
+	std::atomic<int> m_error;
+	
+public:
+	
+	PerfCounters(const Options &o) :
+		
+		m_enabled(o.perfCounters),
+		m_error(0){
+		
+		for(unsigned int i = 0; i < NCOUNTERS; ++i) m_available[i] = false;
+	};
+	
+	
+	// values of counters of current thread at start of stage
+	Sample begin(){
+		
+		Sample sample;
+		
+		if(m_enabled) readCounters(getThreadCounters(), sample);
+		else          clearSample(sample);
+		
+		return sample;
+	}
+	
+	
+	// adds counts of current thread since start of stage for number of reads
+	void end(const Stage stage, const Sample &start, const unsigned int nReads){
+		
+		if(! m_enabled) return;
+		
+		ThreadCounters &tc = getThreadCounters();
+		
+		Sample sample;
+		readCounters(tc, sample);
+		
+		const unsigned long enabled = sample.enabled - start.enabled;
+		const unsigned long running = sample.running - start.running;
+		
+		// counts of time running estimate counts of time enabled
+		if(running > 0){
+			
+			const double scale = static_cast<double>(enabled) / running;
+			
+			for(unsigned int i = 0; i < NCOUNTERS; ++i){
+				tc.total[stage][i] += static_cast<unsigned long>((sample.value[i] - start.value[i]) * scale);
+			}
+		}
+		
+		tc.enabled[stage] += enabled;
+		tc.running[stage] += running;
+		tc.reads[stage]   += nReads;
+	}
+	
+	
+	void printPerfCounters(std::ostream *out) const {
+		
+		using namespace std;
+		
+		if(! m_enabled) return;
+		
+		bool available = false;
+		
+		for(unsigned int i = 0; i < NCOUNTERS; ++i) available = available || m_available[i];
+		
+		if(! available){
+			*out << "Hardware counters:  not available";
+			
+			if(m_error != 0) *out << " (" << strerror(m_error) << ")";
+			
+			*out << "\n";
+			return;
+		}
+		
+		unsigned long total[NSTAGES][NCOUNTERS], reads[NSTAGES], enabled[NSTAGES], running[NSTAGES];
+		
+		for(unsigned int s = 0; s < NSTAGES; ++s){
+			reads[s]   = 0;
+			enabled[s] = 0;
+			running[s] = 0;
+			
+			for(unsigned int i = 0; i < NCOUNTERS; ++i) total[s][i] = 0;
+		}
+		
+		for(TThreadCounters::const_iterator it = m_counters.begin(); it != m_counters.end(); ++it){
+			for(unsigned int s = 0; s < NSTAGES; ++s){
+				
+				reads[s]   += it->reads[s];
+				enabled[s] += it->enabled[s];
+				running[s] += it->running[s];
+				
+				for(unsigned int i = 0; i < NCOUNTERS; ++i) total[s][i] += it->total[s][i];
+			}
+		}
+		
+		*out << "Hardware counters       IPC   cycles/read   cache misses/read   branch misses/read\n";
+		
+		bool multiplexed = false;
+		
+		for(unsigned int s = 0; s < NSTAGES; ++s){
+			
+			if(reads[s] == 0) continue;
+			
+			// group never scheduled while stage ran
+			const bool counted = running[s] > 0;
+			
+			if(running[s] < enabled[s]) multiplexed = true;
+			
+			*out << "  " << left << setw(17) << getName(static_cast<Stage>(s)) << right << fixed << setprecision(2);
+			
+			if(counted && m_available[CYCLES] && m_available[INSTRUCTIONS] && total[s][CYCLES] > 0)
+			     *out << setw(8) << static_cast<double>(total[s][INSTRUCTIONS]) / total[s][CYCLES];
+			else *out << setw(8) << "n/a";
+			
+			printPerRead(out, CYCLES,        counted, total[s], reads[s], 14);
+			printPerRead(out, CACHE_MISSES,  counted, total[s], reads[s], 20);
+			printPerRead(out, BRANCH_MISSES, counted, total[s], reads[s], 21);
+			
+			*out << "\n";
+		}
+		
+		if(reads[ALIGN_DP] > 0) *out << "  (global alignment per alignment instead of read)\n";
+		if(multiplexed)         *out << "  (counts scaled, counters were multiplexed with other events)\n";
+		
+		out->unsetf(ios::floatfield);
+		*out << setprecision(6);
+	}
+	
+private:
+	
+	ThreadCounters& getThreadCounters(){
+		
+		ThreadCounters &tc = m_counters.local();
+		
+		if(! tc.opened){
+			tc.opened = true;
+			
+			const unsigned long long config[NCOUNTERS] = {
+				#ifdef __linux__
+					PERF_COUNT_HW_CPU_CYCLES,
+					PERF_COUNT_HW_INSTRUCTIONS,
+					PERF_COUNT_HW_CACHE_MISSES,
+					PERF_COUNT_HW_BRANCH_MISSES
+				#endif
+			};
+			
+			for(unsigned int i = 0; i < NCOUNTERS; ++i){
+				
+				tc.fd[i] = openCounter(config[i], tc.leader);
+				
+				if(tc.fd[i] >= 0){
+					if(tc.leader < 0) tc.leader = tc.fd[i];
+					
+					tc.pos[i] = tc.nOpened++;
+					m_available[i] = true;
+				}
+			}
+		}
+		return tc;
+	}
+	
+	
+	// opens counter as leader of new group or as member of group of leader
+	int openCounter(const unsigned long long config, const int leader){
+		
+		#ifdef __linux__
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			
+			attr.type           = PERF_TYPE_HARDWARE;
+			attr.size           = sizeof(attr);
+			attr.config         = config;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv     = 1;
+			attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			
+			// current thread on any CPU
+			int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+			
+			if(fd < 0){
+				int expected = 0;
+				m_error.compare_exchange_strong(expected, errno);
+			}
+			return fd;
+		#else
+			m_error = ENOSYS;
+			return -1;
+		#endif
+	}
+	
+	
+	// reads values of group at once with number of values and times first
+	void readCounters(const ThreadCounters &tc, Sample &sample) const {
+		
+		clearSample(sample);
+		
+		#ifdef __linux__
+			if(tc.leader < 0) return;
+			
+			unsigned long long values[3 + NCOUNTERS];
+			
+			const ssize_t size = (3 + tc.nOpened) * sizeof(unsigned long long);
+			
+			if(read(tc.leader, values, size) != size || values[0] != tc.nOpened) return;
+			
+			sample.enabled = values[1];
+			sample.running = values[2];
+			
+			for(unsigned int i = 0; i < NCOUNTERS; ++i){
+				if(tc.pos[i] >= 0) sample.value[i] = values[3 + tc.pos[i]];
+			}
+		#endif
+	}
+	
+	
+	void clearSample(Sample &sample) const {
+		
+		for(unsigned int i = 0; i < NCOUNTERS; ++i) sample.value[i] = 0;
+		
+		sample.enabled = 0;
+		sample.running = 0;
+	}
+	
+	
+	void printPerRead(std::ostream *out, const Counter counter, const bool counted, const unsigned long *total, const unsigned long reads, const int width) const {
+		
+		if(counted && m_available[counter]) *out << std::setw(width) << static_cast<double>(total[counter]) / reads;
+		else                                *out << std::setw(width) << "n/a";
+	}
+	
+	
+	const char* getName(const Stage stage) const {
+		
+		switch(stage){
+			case INPUT:    return "input";
+			case ALIGN:    return "alignment";
+			case ALIGN_DP: return "  global DP";
+			case OUTPUT:   return "output";
+			default:       return "";
+		}
+	}
+	
+};
+
+#endif
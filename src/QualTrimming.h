@@ -7,6 +7,8 @@
 #ifndef FLEXBAR_QUALTRIMMING_H
 #define FLEXBAR_QUALTRIMMING_H
 
+#include "SimdKernels.h"
+
 
 struct Tail {};
 
@@ -18,54 +20,23 @@ struct Window {
 };
 
 
-template <typename TString>
-inline unsigned getQuality(const TString& qual, unsigned i){
-	
-	return static_cast<int>(qual[i]);
-}
-
-
 // Tail trimming method
 template <typename TString>
 unsigned qualTrimming(const TString& qual, unsigned const cutoff, Tail const &){
 	
-	for (int i = length(qual) - 1; i >= 0; --i){
-		
-		if(getQuality(qual, i) >= cutoff) return i + 1;
-    }
-	return 0;
+	if(length(qual) == 0) return 0;
+	
+	return flexbar::qualityTailCut(flexbar::rawSeq(qual), length(qual), cutoff);
 }
 
 
 // Trim by shifting a window over the seq and cut where avg qual in window turns bad
 template <typename TString>
-unsigned qualTrimming(const TString& qual, unsigned const _cutoff, Window const & spec){
-	
-	unsigned window = spec.size;
-	unsigned avg = 0, i = 0;
-	
-	// Absolute cutoff in window to avoid divisions
-	unsigned cutoff = _cutoff * window;
+unsigned qualTrimming(const TString& qual, unsigned const cutoff, Window const & spec){
 	
-	// Calculate average quality of initial window
-	for (i = 0; i < window; ++i){
-		avg += getQuality(qual, i);
-    }
+	if(length(qual) == 0) return 0;
 	
-	// Shift window over read and keep mean quality, update in constant time
-	for (i = 0; i < length(qual) && avg >= cutoff; ++i){
-		
-		// Take care only not to go over the end of the sequence. Shorten window near the end
-		avg -= getQuality(qual, i);
-		
-		if(i + window < length(qual)){
-			avg += getQuality(qual, i + window);
-		}
-		else{
-			cutoff = _cutoff * ((length(qual) - 1) - i);
-		}
-	}
-	return i;   // holds start of first window that turned bad
+	return flexbar::qualityWindowCut(flexbar::rawSeq(qual), length(qual), cutoff, spec.size);
 }
 
 
@@ -73,24 +44,13 @@ unsigned qualTrimming(const TString& qual, unsigned const _cutoff, Window const
 template <typename TString>
 unsigned qualTrimming(const TString& qual, unsigned const cutoff, BWA const &){
 	
-	int max_arg = length(qual) - 1, sum = 0, max = 0;
+	if(length(qual) == 0) return 0;
 	
-	for (int i = length(qual) - 1; i >= 0; --i){
-		
-		sum += cutoff - getQuality(qual, i);
-		
-		if(sum < 0){
-			break;
-        }
-		if(sum > max){
-			max = sum;
-			max_arg = i;
-		}
-	}
-	return max_arg + 1;
+	return flexbar::qualityBwaCut(flexbar::rawSeq(qual), length(qual), cutoff);
 }
 
 
+// trims sequence and qualities in place
 template <typename TSeqStr, typename TString>
 bool qualTrim(TSeqStr &seq, TString &qual, const flexbar::QualTrimType qtrim, const int cutoff, const int wSize){
 	
@@ -110,8 +70,8 @@ bool qualTrim(TSeqStr &seq, TString &qual, const flexbar::QualTrimType qtrim, co
 	
 	if(cutPos < length(qual)){
 		
-		seq  = prefix(seq,  cutPos);
-		qual = prefix(qual, cutPos);
+		resize(seq,  cutPos);
+		resize(qual, cutPos);
 		
 		return true;
 	}
@@ -122,17 +82,7 @@ bool qualTrim(TSeqStr &seq, TString &qual, const flexbar::QualTrimType qtrim, co
 template <typename TSeqStr, typename TString>
 bool qualTrim(SeqRead<TSeqStr, TString> *seqRead, const flexbar::QualTrimType qtrim, const int cutoff, const int wSize){
 	
-	TSeqStr seq  = seqRead->seq;
-	TString qual = seqRead->qual;
-	
-	bool trimmed = qualTrim(seq, qual, qtrim, cutoff, wSize);
-	
-	if(trimmed){
-		seqRead->seq  = seq;
-		seqRead->qual = qual;
-	}
-	
-	return trimmed;
+	return qualTrim(seqRead->seq, seqRead->qual, qtrim, cutoff, wSize);
 }
 
 
@@ -0,0 +1,266 @@
+// ResourceLimits.h
+
+#ifndef FLEXBAR_RESOURCELIMITS_H
+#define FLEXBAR_RESOURCELIMITS_H
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+
+// Detects CPU quota and memory limit of cgroup of process, e.g. set by
+// container runtimes or batch systems. Both cgroup v1 and v2 are read. The
+// smallest limit along the cgroup path up to root applies, because limits
+// of parent groups also restrict nested groups.
+class ResourceLimits {
+
+private:
+	
+	const std::string m_root;
+	
+	int m_version;
+	double m_cpuQuota;
+	unsigned long m_memoryLimit;
+	unsigned int m_nCpus;
+	
+public:
+	
+	ResourceLimits() :
+		
+		m_root("/sys/fs/cgroup"),
+		m_version(0),
+		m_cpuQuota(0),
+		m_memoryLimit(0),
+		m_nCpus(0){
+		
+		readCpus();
+		
+		#ifdef __linux__
+			readCgroups();
+		#endif
+	};
+	
+	
+	// cgroup version 1 or 2, 0 if no limits could be read
+	int getVersion() const {
+		return m_version;
+	}
+	
+	
+	// number of CPUs the process is allowed to run on
+	unsigned int getNrCpus() const {
+		return m_nCpus;
+	}
+	
+	
+	// CPU quota in cores, 0 for no quota
+	double getCpuQuota() const {
+		return m_cpuQuota;
+	}
+	
+	
+	// memory limit in bytes, 0 for no limit
+	unsigned long getMemoryLimit() const {
+		return m_memoryLimit;
+	}
+	
+	
+	// threads that run without throttling by CPU quota
+	unsigned int getNrThreads() const {
+		
+		unsigned int nThreads = m_nCpus;
+		
+		if(m_cpuQuota > 0 && m_cpuQuota < nThreads) nThreads = static_cast<unsigned int>(m_cpuQuota);
+		
+		return (nThreads < 1) ? 1 : nThreads;
+	}
+	
+private:
+	
+	void readCpus(){
+		
+		#ifdef __linux__
+			cpu_set_t cpus;
+			
+			if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0) m_nCpus = CPU_COUNT(&cpus);
+		#endif
+		
+		if(m_nCpus == 0) m_nCpus = std::thread::hardware_concurrency();
+		if(m_nCpus == 0) m_nCpus = 1;
+	}
+	
+	
+	void readCgroups(){
+		
+		using namespace std;
+		
+		ifstream cgroups("/proc/self/cgroup");
+		string line;
+		
+		// lines of hierarchy id, controllers and path of group
+		while(getline(cgroups, line)){
+			
+			size_t first  = line.find(':');
+			size_t second = line.find(':', first + 1);
+			
+			if(first == string::npos || second == string::npos) continue;
+			
+			string controllers = line.substr(first + 1, second - first - 1);
+			string path        = line.substr(second + 1);
+			
+			if(controllers.empty()){
+				
+				// unified hierarchy, controllers are enabled at root
+				if(fileExists(m_root + "/cgroup.controllers")) readCgroup2(path);
+			}
+			else{
+				stringstream ss(controllers);
+				string controller;
+				
+				while(getline(ss, controller, ',')){
+					
+					if(controller == "cpu" || controller == "memory"){
+						
+						string dir = m_root + "/" + controllers;
+						
+						if(! fileExists(dir)) dir = m_root + "/" + controller;
+						
+						readCgroup1(dir, path, controller);
+					}
+				}
+			}
+		}
+		
+		// limits above physical memory are no limits
+		unsigned long physical = static_cast<unsigned long>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+		
+		if(physical > 0 && m_memoryLimit >= physical) m_memoryLimit = 0;
+	}
+	
+	
+	void readCgroup2(const std::string &path){
+		
+		using namespace std;
+		
+		vector<string> dirs = getGroupDirs(m_root, path);
+		
+		for(unsigned int i = 0; i < dirs.size(); ++i){
+			
+			string quota, period, memory;
+			
+			// cpu.max holds quota and period in us, or max
+			if(readValues(dirs[i] + "/cpu.max", quota, period) && quota != "max"){
+				addCpuQuota(quota, period);
+				m_version = 2;
+			}
+			
+			if(readValues(dirs[i] + "/memory.max", memory, period) && memory != "max"){
+				addMemoryLimit(memory);
+				m_version = 2;
+			}
+		}
+	}
+	
+	
+	void readCgroup1(const std::string &root, const std::string &path, const std::string &controller){
+		
+		using namespace std;
+		
+		vector<string> dirs = getGroupDirs(root, path);
+		
+		for(unsigned int i = 0; i < dirs.size(); ++i){
+			
+			string quota, period, memory, unused;
+			
+			if(controller == "cpu"){
+				
+				// quota in us is -1 without limit
+				if(readValues(dirs[i] + "/cpu.cfs_quota_us", quota, unused) && quota != "-1" &&
+				   readValues(dirs[i] + "/cpu.cfs_period_us", period, unused)){
+					
+					addCpuQuota(quota, period);
+					if(m_version == 0) m_version = 1;
+				}
+			}
+			else if(readValues(dirs[i] + "/memory.limit_in_bytes", memory, unused)){
+				
+				addMemoryLimit(memory);
+				if(m_version == 0) m_version = 1;
+			}
+		}
+	}
+	
+	
+	void addCpuQuota(const std::string &quota, const std::string &period){
+		
+		double q = atof(quota.c_str());
+		double p = atof(period.c_str());
+		
+		if(q <= 0 || p <= 0) return;
+		
+		if(m_cpuQuota == 0 || q / p < m_cpuQuota) m_cpuQuota = q / p;
+	}
+	
+	
+	void addMemoryLimit(const std::string &memory){
+		
+		unsigned long limit = strtoul(memory.c_str(), NULL, 10);
+		
+		if(limit == 0) return;
+		
+		if(m_memoryLimit == 0 || limit < m_memoryLimit) m_memoryLimit = limit;
+	}
+	
+	
+	// directories of group and its parents, group path may not be visible
+	// within container and limits of container are found at root then
+	std::vector<std::string> getGroupDirs(const std::string &root, std::string path) const {
+		
+		std::vector<std::string> dirs;
+		
+		while(path.length() > 1 && path[path.length() - 1] == '/') path.erase(path.length() - 1);
+		
+		while(path.length() > 1){
+			
+			if(fileExists(root + path)) dirs.push_back(root + path);
+			
+			path.erase(path.rfind('/'));
+			
+			if(path.empty()) path = "/";
+		}
+		
+		dirs.push_back(root);
+		
+		return dirs;
+	}
+	
+	
+	// reads first two whitespace separated values of file
+	bool readValues(const std::string &file, std::string &first, std::string &second) const {
+		
+		std::ifstream strm(file.c_str());
+		
+		if(! strm.good()) return false;
+		
+		strm >> first >> second;
+		
+		return ! first.empty();
+	}
+	
+	
+	bool fileExists(const std::string &file) const {
+		return access(file.c_str(), F_OK) == 0;
+	}
+	
+};
+
+#endif
@@ -3,6 +3,10 @@
 #ifndef FLEXBAR_SEQALIGN_H
 #define FLEXBAR_SEQALIGN_H
 
+#include "SimdKernels.h"
+#include "SeqAlignAlgo.h"
+#include "SeqAlignAlgoUngapped.h"
+
 
 template <typename TSeqStr, typename TString, class TAlgorithm>
 class SeqAlign {
@@ -11,25 +15,57 @@ private:
 	
 	typedef AlignResults<TSeqStr> TAlignResults;
 	
+	struct CachedAlignment {
+		int qIndex;
+		TAlignResults am;
+	};
+	
+	typedef tbb::concurrent_hash_map<std::string, CachedAlignment> TAlignCache;
+	
+	// statistics of thread, merged once after processing
+	struct AlignStats {
+		
+		unsigned long nPreShortReads, modified, cacheLookups, cacheHits;
+		std::vector<unsigned long> rmOverlaps, rmOverlap, rmFull;
+		
+		AlignStats(const unsigned int nQueries) :
+			nPreShortReads(0),
+			modified(0),
+			cacheLookups(0),
+			cacheHits(0),
+			rmOverlaps(flexbar::MAX_READLENGTH + 1, 0),
+			rmOverlap(nQueries, 0),
+			rmFull(nQueries, 0){
+		}
+	};
+	
 	const flexbar::LogAlign    m_log;
 	const flexbar::FileFormat  m_format;
 	const flexbar::PairOverlap m_poMode;
 	
-	const bool m_isBarcoding, m_writeTag, m_umiTags, m_strictRegion, m_addBarcodeAdapter;
-	const int m_minLength, m_minOverlap, m_tailLength;
+	const bool m_isBarcoding, m_writeTag, m_umiTags, m_strictRegion, m_exactMatch, m_dedup;
+	const int m_minLength, m_minOverlap, m_tailLength, m_match;
 	const float m_errorRate;
 	const unsigned int m_bundleSize;
+	const unsigned long m_cacheSize;
 	
-	tbb::atomic<unsigned long> m_nPreShortReads, m_modified;
+	unsigned long m_nPreShortReads, m_modified;
+	unsigned long m_cacheLookups, m_cacheHits;
+	
+	// entries are counted across threads to bound size of cache
+	std::atomic<unsigned long> m_cacheEntries;
+	TAlignCache m_cache;
 	tbb::concurrent_vector<flexbar::TBar> *m_queries;
-	tbb::concurrent_vector<unsigned long> m_rmOverlaps;
+	std::vector<unsigned long> m_rmOverlaps;
+	
+	tbb::enumerable_thread_specific<AlignStats> m_stats;
 	
-	std::ostream *m_out;
+	AlignLog *m_alignLog;
 	TAlgorithm m_algo;
 	
 public:
 	
-	SeqAlign(tbb::concurrent_vector<flexbar::TBar> *queries, const Options &o, int minOverlap, float errorRate, const int tailLength, const int match, const int mismatch, const int gapCost, const bool isBarcoding):
+	SeqAlign(tbb::concurrent_vector<flexbar::TBar> *queries, const Options &o, AlignLog *alignLog, PerfCounters *perf, int minOverlap, float errorRate, const int tailLength, const int match, const int mismatch, const int gapCost, const bool isBarcoding, const bool writeLog = true):
 			
 			m_minOverlap(minOverlap),
 			m_errorRate(errorRate),
@@ -38,43 +74,84 @@ public:
 			m_umiTags(o.umiTags),
 			m_minLength(o.min_readLen),
 			m_poMode(o.poMode),
-			m_log(o.logAlign),
+			m_log(writeLog ? o.logAlign : flexbar::NONE),
 			m_format(o.format),
 			m_writeTag(o.useRemovalTag),
-			m_addBarcodeAdapter(o.addBarcodeAdapter),
 			m_strictRegion(! o.relaxRegion),
 			m_bundleSize(o.bundleSize),
-			m_out(o.out),
+			m_cacheSize(isBarcoding ? 0 : o.a_cacheSize),
+			m_dedup(o.dedupBundle),
+			m_alignLog(alignLog),
+			m_match(match),
+			m_exactMatch(! isBarcoding && match > 0 && mismatch < match && gapCost < 0 &&
+			             m_log != flexbar::ALL && m_log != flexbar::MOD),
 			m_nPreShortReads(0),
 			m_modified(0),
+			m_cacheEntries(0),
+			m_cacheLookups(0),
+			m_cacheHits(0),
+			m_rmOverlaps(flexbar::MAX_READLENGTH + 1, 0),
+			m_stats(AlignStats(queries->size())),
 			m_algo(TAlgorithm(o, match, mismatch, gapCost, ! isBarcoding)){
 		
-		m_queries    = queries;
-		m_rmOverlaps = tbb::concurrent_vector<unsigned long>(flexbar::MAX_READLENGTH + 1, 0);
+		m_queries = queries;
+		
+		setPerfCounters(m_algo, perf);
 	};
 	
 	
-	int alignSeqRead(flexbar::TSeqRead* sr, const bool performRemoval, flexbar::Alignments &alignments, flexbar::ComputeCycle &cycle, unsigned int &idxAl, const flexbar::AlignmentMode &alMode, const flexbar::TrimEnd trimEnd, const TSeqStr &addBarcode){
+	int alignSeqRead(flexbar::TSeqRead* sr, const bool performRemoval, flexbar::Alignments &alignments, flexbar::ComputeCycle &cycle, unsigned int &idxAl, const flexbar::AlignmentMode &alMode, const flexbar::TrimEnd trimEnd, flexbar::BarcodeAdapters *barAdapters){
 		
-		using namespace std;
 		using namespace flexbar;
 		
-		using seqan::prefix;
-		using seqan::suffix;
+		TAlignResults am;
+		
+		int qIndex = findAlignment(am, sr, alignments, cycle, idxAl, alMode, trimEnd, barAdapters);
+		
+		if(cycle == PRELOAD) return 0;
+		
+		return applyAlignment(sr, performRemoval, qIndex, am, trimEnd);
+	}
+	
+	
+	// preloads alignments of read, returns index of best valid query after preload
+	int findAlignment(TAlignResults &am, flexbar::TSeqRead* sr, flexbar::Alignments &alignments, flexbar::ComputeCycle &cycle, unsigned int &idxAl, const flexbar::AlignmentMode &alMode, const flexbar::TrimEnd trimEnd, flexbar::BarcodeAdapters *barAdapters){
+		
+		using namespace std;
+		using namespace flexbar;
 		
 		TSeqRead &seqRead = *sr;
 		int readLength    = length(seqRead.seq);
 		
-		if(! m_isBarcoding && readLength < m_minLength){
-			if(cycle != PRELOAD) ++m_nPreShortReads;
-			// return 0;
-		}
+		if(readLength < 1) return -1;
 		
-		if(readLength < 1) return 0;
+		const bool exactMatch = m_exactMatch && barAdapters == NULL;
+		const bool useCache   = m_cacheSize > 0 && barAdapters == NULL;
+		const bool dedup      = m_dedup && barAdapters == NULL;
 		
 		
 		if(cycle == PRELOAD){
 			
+			// exact adapter occurrences are resolved without alignment
+			if(exactMatch){
+				TAlignResults a;
+				if(findExactQuery(a, seqRead, alMode, trimEnd) >= 0) return -1;
+			}
+			
+			std::string key;
+			if(useCache || dedup) key = getCacheKey(seqRead, alMode, trimEnd);
+			
+			// repeated reads are resolved with cached alignment
+			if(useCache){
+				bool cached = m_cache.count(key) > 0;
+				
+				alignments.cached.push_back(cached);
+				if(cached) return -1;
+			}
+			
+			// identical reads of bundle are aligned only once
+			if(dedup && ! alignments.addToGroup(key)) return -1;
+			
 			if(idxAl == 0) reserve(alignments.aset, m_bundleSize * m_queries->size());
 			
 			for(unsigned int i = 0; i < m_queries->size(); ++i){
@@ -83,22 +160,19 @@ public:
 				else if(alMode == ALIGNRC    && ! m_queries->at(i).rcAdapter) continue;
 				
 				TSeqStr *qseq = &m_queries->at(i).seq;
-				TSeqStr *rseq = &seqRead.seq;
-				TSeqStr tmp, tmpq;
 				
-				if(! m_isBarcoding && m_addBarcodeAdapter && addBarcode != ""){
-					tmpq = addBarcode;
-					append(tmpq, m_queries->at(i).seq);
-					qseq = &tmpq;
-				}
+				// precomputed query with barcode of mate
+				if(barAdapters != NULL) qseq = &barAdapters->seqs[i];
+				
+				int regionStart = 0;
+				int regionEnd   = readLength;
 				
 				if(trimEnd == LTAIL || trimEnd == RTAIL){
 					int tailLength  = (m_tailLength > 0) ? m_tailLength : length(*qseq);
 					
 					if(tailLength < readLength){
-						if(trimEnd == LTAIL) tmp = prefix(seqRead.seq, tailLength);
-						else                 tmp = suffix(seqRead.seq, readLength - tailLength);
-						rseq = &tmp;
+						if(trimEnd == LTAIL) regionEnd   = tailLength;
+						else                 regionStart = readLength - tailLength;
 					}
 				}
 				
@@ -106,66 +180,120 @@ public:
 				appendValue(alignments.aset, align);
 				resize(rows(alignments.aset[idxAl]), 2);
 				
-				assignSource(row(alignments.aset[idxAl], 0), *rseq);
-				assignSource(row(alignments.aset[idxAl], 1), *qseq);
+				// rows reference read and query without copies
+				assignSource(row(alignments.aset[idxAl], 0), infix(seqRead.seq, regionStart, regionEnd));
+				assignSource(row(alignments.aset[idxAl], 1), infix(*qseq, 0, length(*qseq)));
 				
 				++idxAl;
 			}
-			return 0;
+			return -1;
 		}
 		
-		TAlignResults am;
-		
 		int qIndex  = -1;
 		int amScore = numeric_limits<int>::min();
 		
-		// align each query sequence and store best one
-		for(unsigned int i = 0; i < m_queries->size(); ++i){
-			
-			if     (alMode == ALIGNRCOFF &&   m_queries->at(i).rcAdapter) continue;
-			else if(alMode == ALIGNRC    && ! m_queries->at(i).rcAdapter) continue;
-			
-			TAlignResults a;
-			
-			// global sequence alignment
-			m_algo.alignGlobal(a, alignments, cycle, idxAl++, trimEnd);
-			
-			a.queryLength = length(m_queries->at(i).seq);
+		bool alignQueries = true;
+		std::string cacheKey;
+		
+		if(exactMatch) qIndex = findExactQuery(am, seqRead, alMode, trimEnd);
+		
+		if(qIndex < 0 && useCache){
+			cacheKey = getCacheKey(seqRead, alMode, trimEnd);
+			++m_stats.local().cacheLookups;
 			
-			if(! m_isBarcoding && m_addBarcodeAdapter && addBarcode != ""){
-				a.queryLength += length(addBarcode);
+			// entries are never removed after preload
+			if(alignments.cached[alignments.idxCached++]){
+				typename TAlignCache::const_accessor ca;
+				m_cache.find(ca, cacheKey);
+				
+				qIndex = ca->second.qIndex;
+				am     = ca->second.am;
+				
+				alignQueries = false;
+				++m_stats.local().cacheHits;
 			}
+		}
+		
+		int group = -1;
+		
+		if(qIndex < 0 && alignQueries && dedup){
+			group = alignments.groups[alignments.idxGroup++];
 			
-			a.tailLength  = (m_tailLength > 0) ? m_tailLength : a.queryLength;
-			
-			a.overlapLength = a.endPos - a.startPos;
-			a.allowedErrors = m_errorRate * a.overlapLength;
-			
-			float madeErrors = static_cast<float>(a.mismatches + a.gapsR + a.gapsA);
-			int minOverlap   = (m_isBarcoding && m_minOverlap == 0) ? a.queryLength : m_minOverlap;
-			
-			if(! m_isBarcoding && m_poMode == PON && seqRead.pairOverlap &&
-				(trimEnd == RIGHT || trimEnd == RTAIL)) minOverlap = 1;
+			// result of first read in group
+			if(alignments.groupQuery[group] != -2){
+				qIndex = alignments.groupQuery[group];
+				am     = alignments.groupResults[group];
+				
+				alignQueries = false;
+			}
+		}
+		
+		// align each query sequence and store best one
+		if(qIndex < 0 && alignQueries){
 			
-			bool validAl = true;
+			// umi positions of prepended barcode are wildcards without tag
+			const int umiStart = (barAdapters != NULL) ? barAdapters->barLength : 0;
 			
-			if(((trimEnd == RTAIL  || trimEnd == RIGHT) && a.startPosA < a.startPosS && m_strictRegion) ||
-			   ((trimEnd == LTAIL  || trimEnd == LEFT)  && a.endPosA   > a.endPosS   && m_strictRegion) ||
-			     a.overlapLength < 1){
+			for(unsigned int i = 0; i < m_queries->size(); ++i){
 				
-				validAl = false;
+				if     (alMode == ALIGNRCOFF &&   m_queries->at(i).rcAdapter) continue;
+				else if(alMode == ALIGNRC    && ! m_queries->at(i).rcAdapter) continue;
+				
+				TAlignResults a;
+				
+				// global sequence alignment
+				m_algo.alignGlobal(a, alignments, cycle, idxAl++, trimEnd, umiStart);
+				
+				a.queryLength = length(m_queries->at(i).seq);
+				
+				if(barAdapters != NULL) a.queryLength += barAdapters->barLength;
+				
+				a.tailLength  = (m_tailLength > 0) ? m_tailLength : a.queryLength;
+				
+				// check if alignment is valid, score max, number of errors and overlap length
+				if(isValidAlignment(a, seqRead, trimEnd) && a.score > amScore){
+					
+					am      = a;
+					amScore = a.score;
+					qIndex  = i;
+				}
 			}
 			
-			// check if alignment is valid, score max, number of errors and overlap length
-			if(validAl && a.score > amScore && madeErrors <= a.allowedErrors && a.overlapLength >= minOverlap){
-				
-				am      = a;
-				amScore = a.score;
-				qIndex  = i;
+			if(useCache) storeAlignment(cacheKey, qIndex, am);
+			
+			if(group >= 0){
+				alignments.groupQuery[group]   = qIndex;
+				alignments.groupResults[group] = am;
 			}
 		}
+		return qIndex;
+	}
+	
+	
+	// counts read skipped in later adapter cycle like applyAlignment
+	void addSkippedRead(const flexbar::TSeqRead* sr){
 		
-		stringstream s;
+		if(! m_isBarcoding && static_cast<int>(length(sr->seq)) < m_minLength) ++m_stats.local().nPreShortReads;
+	}
+	
+	
+	// trims read based on best alignment, returns query index plus one
+	int applyAlignment(flexbar::TSeqRead* sr, const bool performRemoval, int qIndex, TAlignResults &am, const flexbar::TrimEnd trimEnd){
+		
+		using namespace std;
+		using namespace flexbar;
+		
+		TSeqRead &seqRead = *sr;
+		int readLength    = length(seqRead.seq);
+		
+		AlignStats &stats = m_stats.local();
+		
+		if(! m_isBarcoding && readLength < m_minLength){
+			++stats.nPreShortReads;
+			// return 0;
+		}
+		
+		if(readLength < 1) return 0;
 		
 		// valid alignment
 		if(qIndex >= 0){
@@ -230,7 +358,7 @@ public:
 	                case ANY:;
 				}
 				
-				++m_modified;
+				++stats.modified;
 				
 				if(! m_isBarcoding){
 					if(! m_queries->at(qIndex).rcAdapter) seqRead.rmAdapter   = true;
@@ -238,10 +366,10 @@ public:
 				}
 				
 				// count number of removals for each query
-				m_queries->at(qIndex).rmOverlap++;
+				stats.rmOverlap.at(qIndex)++;
 				
 				if(am.overlapLength == am.queryLength)
-				m_queries->at(qIndex).rmFull++;
+				stats.rmFull.at(qIndex)++;
 				
 				if(m_writeTag){
 					append(seqRead.id, "_Flexbar_removal");
@@ -253,7 +381,7 @@ public:
 				}
 				
 				// store overlap occurrences
-				if(am.overlapLength <= MAX_READLENGTH) m_rmOverlaps.at(am.overlapLength)++;
+				if(am.overlapLength <= MAX_READLENGTH) stats.rmOverlaps.at(am.overlapLength)++;
 				else cerr << "\nCompile Flexbar with larger max read length for correct overlap stats.\n" << endl;
 			}
 			
@@ -267,6 +395,8 @@ public:
 			// alignment stats
 			if(m_log == ALL || (m_log == MOD && performRemoval)){
 				
+				ostream &s = m_alignLog->stream();
+				
 				if(performRemoval){
 					s << "Sequence removal:";
 					
@@ -294,23 +424,217 @@ public:
 				s << "\n  Alignment:\n" << endl << am.alString;
 			}
 			else if(m_log == TAB){
+				ostream &s = m_alignLog->stream();
+				
 				s << seqRead.id    << "\t" << m_queries->at(qIndex).id << "\t"
 				  << am.startPosA  << "\t" << am.endPosA               << "\t" << am.overlapLength << "\t"
 				  << am.mismatches << "\t" << am.gapsR + am.gapsA      << "\t" << am.allowedErrors << endl;
 			}
 		}
 		else if(m_log == ALL){
+			ostream &s = m_alignLog->stream();
+			
 			s << "Unvalid alignment:"        << "\n"
 			  << "read id   " << seqRead.id  << "\n"
 			  << "read seq  " << seqRead.seq << "\n\n" << endl;
 		}
 		
-		*m_out << s.str();
-		
 		return ++qIndex;
 	}
 	
 	
+	bool isValidAlignment(TAlignResults &a, const flexbar::TSeqRead &seqRead, const flexbar::TrimEnd trimEnd){
+		
+		using namespace flexbar;
+		
+		a.overlapLength = a.endPos - a.startPos;
+		a.allowedErrors = m_errorRate * a.overlapLength;
+		
+		float madeErrors = static_cast<float>(a.mismatches + a.gapsR + a.gapsA);
+		int minOverlap   = (m_isBarcoding && m_minOverlap == 0) ? a.queryLength : m_minOverlap;
+		
+		if(! m_isBarcoding && m_poMode == PON && seqRead.pairOverlap &&
+			(trimEnd == RIGHT || trimEnd == RTAIL)) minOverlap = 1;
+		
+		if(((trimEnd == RTAIL  || trimEnd == RIGHT) && a.startPosA < a.startPosS && m_strictRegion) ||
+		   ((trimEnd == LTAIL  || trimEnd == LEFT)  && a.endPosA   > a.endPosS   && m_strictRegion) ||
+		     a.overlapLength < 1){
+			
+			return false;
+		}
+		
+		return madeErrors <= a.allowedErrors && a.overlapLength >= minOverlap;
+	}
+	
+	
+	// ungapped alignments are computed individually without batch for counters
+	void setPerfCounters(SeqAlignAlgo<TSeqStr> &algo, PerfCounters *perf){
+		algo.setPerfCounters(perf);
+	}
+	
+	void setPerfCounters(SeqAlignAlgoUngapped<TSeqStr> &, PerfCounters *){
+	}
+	
+	
+	// Returns query index if a query occurs exactly and only once in full length
+	// and no other query can reach a better score, otherwise -1 for alignment.
+	int findExactQuery(TAlignResults &am, const flexbar::TSeqRead &seqRead, const flexbar::AlignmentMode &alMode, const flexbar::TrimEnd trimEnd){
+		
+		using namespace std;
+		using namespace flexbar;
+		
+		const int readLength      = length(seqRead.seq);
+		const unsigned char *read = rawSeq(seqRead.seq);
+		
+		int qIndex  = -1;
+		int amScore = numeric_limits<int>::min();
+		
+		for(unsigned int i = 0; i < m_queries->size(); ++i){
+			
+			if     (alMode == ALIGNRCOFF &&   m_queries->at(i).rcAdapter) continue;
+			else if(alMode == ALIGNRC    && ! m_queries->at(i).rcAdapter) continue;
+			
+			const TSeqStr &qseq = m_queries->at(i).seq;
+			
+			int queryLength = length(qseq);
+			int maxScore    = queryLength * m_match;
+			
+			// query can not replace best one
+			if(maxScore <= amScore) continue;
+			
+			int tailLength   = (m_tailLength > 0) ? m_tailLength : queryLength;
+			int regionStart  = 0;
+			int regionLength = readLength;
+			
+			if((trimEnd == LTAIL || trimEnd == RTAIL) && tailLength < readLength){
+				regionLength = tailLength;
+				
+				if(trimEnd == RTAIL) regionStart = readLength - tailLength;
+			}
+			
+			if(queryLength < 1 || queryLength > regionLength) return -1;
+			
+			const unsigned char *query = rawSeq(qseq);
+			
+			int hitPos = -1;
+			
+			for(int p = 0; p <= regionLength - queryLength; ++p){
+				
+				if(countMismatches(read + regionStart + p, query, queryLength, 0, true) == 0){
+					
+					// several optimal alignments, leave choice to alignment
+					if(hitPos >= 0) return -1;
+					
+					hitPos = p;
+				}
+			}
+			
+			// best alignment of query is unknown
+			if(hitPos < 0) return -1;
+			
+			TAlignResults a;
+			
+			a.score      = maxScore;
+			a.mismatches = 0;
+			a.gapsR      = 0;
+			a.gapsA      = 0;
+			
+			a.startPosS  = 0;
+			a.startPosA  = hitPos;
+			a.endPosS    = regionLength;
+			a.endPosA    = hitPos + queryLength;
+			a.startPos   = hitPos;
+			a.endPos     = hitPos + queryLength;
+			
+			a.queryLength = queryLength;
+			a.tailLength  = tailLength;
+			
+			if(m_umiTags){
+				a.umiTag = "";
+				
+				for(int j = 0; j < queryLength; ++j){
+					if(query[j] == DNA5_N) append(a.umiTag, seqRead.seq[regionStart + hitPos + j]);
+				}
+			}
+			
+			if(isValidAlignment(a, seqRead, trimEnd)){
+				
+				am      = a;
+				amScore = a.score;
+				qIndex  = i;
+			}
+		}
+		return qIndex;
+	}
+	
+	
+	// Key of read region considered for alignment, including alignment mode
+	// and pair overlap state which influence the best valid alignment.
+	std::string getCacheKey(const flexbar::TSeqRead &seqRead, const flexbar::AlignmentMode &alMode, const flexbar::TrimEnd trimEnd){
+		
+		using namespace flexbar;
+		
+		int readLength   = length(seqRead.seq);
+		int regionStart  = 0;
+		int regionLength = readLength;
+		
+		if((trimEnd == LTAIL || trimEnd == RTAIL) && m_tailLength > 0 && m_tailLength < readLength){
+			regionLength = m_tailLength;
+			
+			if(trimEnd == RTAIL) regionStart = readLength - m_tailLength;
+		}
+		
+		std::string key(reinterpret_cast<const char*>(rawSeq(seqRead.seq)) + regionStart, regionLength);
+		
+		key += static_cast<char>(alMode);
+		key += static_cast<char>(trimEnd);
+		key += seqRead.pairOverlap ? '1' : '0';
+		
+		return key;
+	}
+	
+	
+	// cache is filled with first distinct reads until it is full
+	void storeAlignment(const std::string &key, const int qIndex, const TAlignResults &am){
+		
+		if(m_cacheEntries >= m_cacheSize) return;
+		
+		typename TAlignCache::accessor ca;
+		
+		if(m_cache.insert(ca, key)){
+			ca->second.qIndex = qIndex;
+			ca->second.am     = am;
+			
+			++m_cacheEntries;
+		}
+	}
+	
+	
+	// adds statistics of all threads to totals and query counts
+	void mergeStats(){
+		
+		typedef typename tbb::enumerable_thread_specific<AlignStats>::iterator TStatsIter;
+		
+		for(TStatsIter it = m_stats.begin(); it != m_stats.end(); ++it){
+			
+			m_nPreShortReads += it->nPreShortReads;
+			m_modified       += it->modified;
+			m_cacheLookups   += it->cacheLookups;
+			m_cacheHits      += it->cacheHits;
+			
+			for(unsigned int i = 0; i <= flexbar::MAX_READLENGTH; ++i)
+				m_rmOverlaps.at(i) += it->rmOverlaps.at(i);
+			
+			for(unsigned int i = 0; i < it->rmOverlap.size(); ++i){
+				m_queries->at(i).rmOverlap += it->rmOverlap.at(i);
+				m_queries->at(i).rmFull    += it->rmFull.at(i);
+			}
+		}
+		
+		m_stats.clear();
+	}
+	
+	
 	std::string getOverlapStatsString(){
 		
 		using namespace std;
@@ -349,6 +673,12 @@ public:
 		s << "Min, max, mean and median overlap: ";
 		s << min << " / " << max << " / " << mean << " / " << median;
 		
+		if(m_cacheLookups > 0){
+			s << "\nCached alignments used for reads:  ";
+			s << m_cacheHits << " of " << m_cacheLookups << "   (" << fixed << setprecision(2);
+			s << 100.0 * m_cacheHits / m_cacheLookups << "%)";
+		}
+		
 		return s.str();
 	}
 	
@@ -24,12 +24,15 @@ private:
 	const bool m_umiTags, m_isAdapterRm;
 	const flexbar::LogAlign m_log;
 	
+	PerfCounters *m_perf;
+	
 public:
 	
 	SeqAlignAlgo(const Options &o, const int match, const int mismatch, const int gapCost, const bool isAdapterRm):
 			m_umiTags(o.umiTags),
 			m_isAdapterRm(isAdapterRm),
-			m_log(o.logAlign){
+			m_log(o.logAlign),
+			m_perf(NULL){
 		
 		using namespace seqan;
 		
@@ -49,7 +52,13 @@ public:
 	};
 	
 	
-	void alignGlobal(TAlignResults &a, flexbar::Alignments &alignments, flexbar::ComputeCycle &cycle, const unsigned int idxAl, const flexbar::TrimEnd trimEnd){
+	// counts hardware events of each batch of alignments
+	void setPerfCounters(PerfCounters *perf){
+		m_perf = perf;
+	}
+	
+	
+	void alignGlobal(TAlignResults &a, flexbar::Alignments &alignments, flexbar::ComputeCycle &cycle, const unsigned int idxAl, const flexbar::TrimEnd trimEnd, const int umiStart){
 		
 		using namespace std;
 		using namespace seqan;
@@ -68,6 +77,10 @@ public:
 			
 			cycle = RESULTS;
 			
+			PerfCounters::Sample counts;
+			
+			if(m_perf != NULL) counts = m_perf->begin();
+			
 			if(trimEnd == RIGHT || trimEnd == RTAIL){
 				
 				AlignConfig<true, false, true, true> ac;
@@ -82,6 +95,8 @@ public:
 				AlignConfig<true, true, true, true> ac;
 				alignments.ascores = globalAlignment(alignments.aset, m_scoreMatrix, ac);
 			}
+			
+			if(m_perf != NULL) m_perf->end(PerfCounters::ALIGN_DP, counts, length(alignments.aset));
 		}
 		
 		TAlign &align = alignments.aset[idxAl];
@@ -106,7 +121,7 @@ public:
 		// cout << endPosS   << endl << endPosA   << endl;
 		
 		
-		if(m_log != NONE){
+		if(m_log == ALL || m_log == MOD){
 			stringstream s;
 			s << align;
 			a.alString = s.str();
@@ -119,6 +134,7 @@ public:
 		TRowIterator it2 = begin(row2);
 		
 		int alPos    = 0;
+		int qPos     = 0;
 		a.gapsR      = 0;
 		a.gapsA      = 0;
 		a.mismatches = 0;
@@ -129,8 +145,10 @@ public:
 				     if(isGap(it1))                                                       ++a.gapsR;
 				else if(isGap(it2))                                                       ++a.gapsA;
 				else if(*it1 != *it2 && *it2 != 'N' && (*it1 != 'N' || ! m_isAdapterRm))  ++a.mismatches;
-				else if(m_umiTags    && *it2 == 'N')                                      append(a.umiTag, (TChar) *it1);
+				else if(m_umiTags    && *it2 == 'N' && qPos >= umiStart)                  append(a.umiTag, (TChar) *it1);
 			}
+			if(! isGap(it2)) ++qPos;
+			
 			++alPos;
 			++it2;
 		}
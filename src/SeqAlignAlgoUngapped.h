@@ -0,0 +1,196 @@
+// SeqAlignAlgoUngapped.h
+
+#ifndef FLEXBAR_SEQALIGNALGOUNGAPPED_H
+#define FLEXBAR_SEQALIGNALGOUNGAPPED_H
+
+#include "SimdKernels.h"
+
+
+template <typename TSeqStr>
+class SeqAlignAlgoUngapped {
+
+private:
+	
+	typedef typename seqan::Value<TSeqStr>::Type TChar;
+	
+	typedef AlignResults<TSeqStr> TAlignResults;
+	
+	const int m_match, m_mismatch, m_gapCost;
+	const bool m_umiTags, m_isAdapterRm;
+	const flexbar::LogAlign m_log;
+	
+public:
+	
+	SeqAlignAlgoUngapped(const Options &o, const int match, const int mismatch, const int gapCost, const bool isAdapterRm):
+			m_match(match),
+			m_mismatch(mismatch),
+			m_gapCost(gapCost),
+			m_umiTags(o.umiTags),
+			m_isAdapterRm(isAdapterRm),
+			m_log(o.logAlign){
+	};
+	
+	
+	void alignGlobal(TAlignResults &a, flexbar::Alignments &alignments, flexbar::ComputeCycle &cycle, const unsigned int idxAl, const flexbar::TrimEnd trimEnd, const int umiStart){
+		
+		using namespace seqan;
+		using namespace flexbar;
+		
+		// ungapped alignments are computed individually
+		if(cycle == COMPUTE) cycle = RESULTS;
+		
+		TAlign &align = alignments.aset[idxAl];
+		
+		alignUngapped(a, source(row(align, 0)), source(row(align, 1)), trimEnd, umiStart);
+	}
+	
+	
+	template <typename TRead, typename TQuery>
+	void alignUngapped(TAlignResults &a, const TRead &read, const TQuery &query, const flexbar::TrimEnd trimEnd, const int umiStart){
+		
+		scanOffsets(a, read, query, trimEnd, false);
+		
+		setResultStrings(a, read, query, umiStart);
+	}
+	
+	
+	// aligns read to reverse complement of mate without copying mate
+	template <typename TRead, typename TMate>
+	void alignUngappedRC(TAlignResults &a, const TRead &read, const TMate &mate, const flexbar::TrimEnd trimEnd){
+		
+		scanOffsets(a, read, mate, trimEnd, true);
+		
+		a.umiTag = "";
+		
+		if(m_log == flexbar::ALL || m_log == flexbar::MOD){
+			TSeqStr rcMate = mate;
+			seqan::reverseComplement(rcMate);
+			
+			setResultStrings(a, read, rcMate, 0);
+		}
+	}
+	
+	
+	// Tests all offsets of query relative to read without gaps. Overhangs of
+	// query are scored as end gaps like in gapped alignment of trim-end mode.
+	template <typename TRead, typename TQuery>
+	void scanOffsets(TAlignResults &a, const TRead &read, const TQuery &query, const flexbar::TrimEnd trimEnd, const bool rcQuery){
+		
+		using namespace std;
+		using namespace flexbar;
+		
+		const int readLength  = length(read);
+		const int queryLength = length(query);
+		
+		const bool freeStart = (trimEnd != RIGHT && trimEnd != RTAIL);
+		const bool freeEnd   = (trimEnd != LEFT  && trimEnd != LTAIL);
+		const bool prune     = m_match > m_mismatch;
+		
+		int bestScore      = numeric_limits<int>::min();
+		int bestPos        = 0;
+		int bestMismatches = 0;
+		
+		if(readLength > 0 && queryLength > 0){
+			
+			const unsigned char *r = rawSeq(read);
+			const unsigned char *q = rawSeq(query);
+			
+			for(int p = 1 - queryLength; p < readLength; ++p){
+				
+				int rStart  = (p > 0) ? p : 0;
+				int overlap = ((p + queryLength < readLength) ? p + queryLength : readLength) - rStart;
+				
+				int penalty = 0;
+				
+				if(p < 0 && ! freeStart)                         penalty -= p * m_gapCost;
+				if(p + queryLength > readLength && ! freeEnd)    penalty += (p + queryLength - readLength) * m_gapCost;
+				
+				// score without mismatches
+				int maxScore = overlap * m_match + penalty;
+				
+				unsigned int bound = overlap;
+				
+				if(prune && bestScore != numeric_limits<int>::min()){
+					
+					if(maxScore <= bestScore) continue;
+					
+					bound = (maxScore - bestScore - 1) / (m_match - m_mismatch);
+				}
+				
+				unsigned int mismatches;
+				
+				if(rcQuery) mismatches = countMismatchesRC(r + rStart, q + queryLength - 1 - (rStart - p), overlap, bound, m_isAdapterRm);
+				else        mismatches = countMismatches(r + rStart, q + rStart - p, overlap, bound, m_isAdapterRm);
+				
+				if(mismatches > bound) continue;
+				
+				int score = maxScore - static_cast<int>(mismatches) * (m_match - m_mismatch);
+				
+				if(score > bestScore){
+					bestScore      = score;
+					bestPos        = p;
+					bestMismatches = mismatches;
+				}
+			}
+		}
+		
+		a.score      = bestScore;
+		a.mismatches = bestMismatches;
+		a.gapsR      = 0;
+		a.gapsA      = 0;
+		
+		a.startPosS = (bestPos < 0) ? -bestPos : 0;
+		a.startPosA = (bestPos < 0) ? 0 : bestPos;
+		a.endPosS   = a.startPosS + readLength;
+		a.endPosA   = a.startPosA + queryLength;
+		
+		a.startPos = (a.startPosA > a.startPosS) ? a.startPosA : a.startPosS;
+		a.endPos   = (a.endPosA   > a.endPosS)   ? a.endPosS   : a.endPosA;
+		
+		if(readLength == 0 || queryLength == 0) a.endPos = a.startPos;
+	}
+	
+	
+	// query positions before umiStart are not used for umi tags
+	template <typename TRead, typename TQuery>
+	void setResultStrings(TAlignResults &a, const TRead &read, const TQuery &query, const int umiStart){
+		
+		using namespace std;
+		using namespace flexbar;
+		
+		if(m_umiTags){
+			a.umiTag = "";
+			
+			for(int i = a.startPos; i < a.endPos; ++i){
+				if(query[i - a.startPosA] == 'N' && i - a.startPosA >= umiStart) append(a.umiTag, (TChar) read[i - a.startPosS]);
+			}
+		}
+		
+		if(m_log == ALL || m_log == MOD){
+			stringstream s;
+			
+			int viewLength = (a.endPosS > a.endPosA) ? a.endPosS : a.endPosA;
+			
+			s << "        " << string(a.startPosS, '-') << read  << string(viewLength - a.endPosS, '-') << "\n";
+			s << "        " << string(a.startPos,  ' ');
+			
+			for(int i = a.startPos; i < a.endPos; ++i){
+				
+				TChar rc = read[i - a.startPosS];
+				TChar qc = query[i - a.startPosA];
+				
+				if(rc == qc || qc == 'N' || (rc == 'N' && m_isAdapterRm)) s << "|";
+				else                                                      s << " ";
+			}
+			
+			s << "\n";
+			s << "        " << string(a.startPosA, '-') << query << string(viewLength - a.endPosA, '-') << "\n\n";
+			
+			a.alString = s.str();
+		}
+	}
+	
+};
+
+
+#endif
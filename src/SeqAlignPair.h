@@ -3,6 +3,9 @@
 #ifndef FLEXBAR_SEQALIGNPAIR_H
 #define FLEXBAR_SEQALIGNPAIR_H
 
+#include "SimdKernels.h"
+#include "SeqAlignAlgoUngapped.h"
+
 
 template <typename TSeqStr, typename TString, class TAlgorithm>
 class SeqAlignPair {
@@ -11,24 +14,41 @@ private:
 	
 	typedef AlignResults<TSeqStr> TAlignResults;
 	
+	// statistics of thread, merged once after processing
+	struct PairStats {
+		
+		unsigned long nPreShortReads, overlaps, modified;
+		std::vector<unsigned long> overlapLengths;
+		
+		PairStats() :
+			nPreShortReads(0),
+			overlaps(0),
+			modified(0),
+			overlapLengths(flexbar::MAX_READLENGTH + 1, 0){
+		}
+	};
+	
 	const flexbar::LogAlign    m_log;
 	const flexbar::FileFormat  m_format;
 	const flexbar::PairOverlap m_poMode;
 	
-	const bool m_writeTag;
+	const bool m_writeTag, m_verify, m_ungapped, m_dedup;
 	const int m_minLength, m_minOverlap, m_aMinOverlap;
 	const float m_errorRate;
 	const unsigned int m_bundleSize;
 	
-	tbb::atomic<unsigned long> m_nPreShortReads, m_overlaps, m_modified;
-	tbb::concurrent_vector<unsigned long> m_overlapLengths;
+	unsigned long m_nPreShortReads, m_overlaps, m_modified;
+	std::vector<unsigned long> m_overlapLengths;
+	tbb::enumerable_thread_specific<PairStats> m_stats;
+	tbb::concurrent_vector<flexbar::TBar> *m_adapters, *m_adapters2;
 	
-	std::ostream *m_out;
+	AlignLog *m_alignLog;
 	TAlgorithm m_algo;
+	SeqAlignAlgoUngapped<TSeqStr> m_ualgo;
 	
 public:
 	
-	SeqAlignPair(const Options &o, const int minOverlap, const float errorRate, const int match, const int mismatch, const int gapCost):
+	SeqAlignPair(tbb::concurrent_vector<flexbar::TBar> *adapters, tbb::concurrent_vector<flexbar::TBar> *adapters2, const Options &o, AlignLog *alignLog, PerfCounters *perf, const int minOverlap, const float errorRate, const int match, const int mismatch, const int gapCost):
 			
 			m_minOverlap(minOverlap),
 			m_aMinOverlap(o.a_min_overlap),
@@ -38,14 +58,22 @@ public:
 			m_log(o.logAlign),
 			m_format(o.format),
 			m_writeTag(o.useRemovalTag),
+			m_verify(o.poVerify),
+			m_ungapped(o.poUngapped),
+			m_dedup(o.dedupBundle),
 			m_bundleSize(o.bundleSize),
-			m_out(o.out),
+			m_alignLog(alignLog),
 			m_nPreShortReads(0),
 			m_overlaps(0),
 			m_modified(0),
-			m_algo(TAlgorithm(o, match, mismatch, gapCost, true)){
+			m_overlapLengths(flexbar::MAX_READLENGTH + 1, 0),
+			m_algo(TAlgorithm(o, match, mismatch, gapCost, true)),
+			m_ualgo(o, match, mismatch, gapCost, true){
+		
+		m_algo.setPerfCounters(perf);
 		
-		m_overlapLengths = tbb::concurrent_vector<unsigned long>(flexbar::MAX_READLENGTH + 1, 0);
+		m_adapters  = adapters;
+		m_adapters2 = (o.adapRm == flexbar::NORMAL2) ? adapters2 : adapters;
 	};
 	
 	
@@ -60,9 +88,11 @@ public:
 		int readLength  = length(seqRead.seq);
 		int readLength2 = length(seqRead2.seq);
 		
+		PairStats &stats = m_stats.local();
+		
 		if(cycle != PRELOAD){
-			if(readLength  < m_minLength) ++m_nPreShortReads;
-			if(readLength2 < m_minLength) ++m_nPreShortReads;
+			if(readLength  < m_minLength) ++stats.nPreShortReads;
+			if(readLength2 < m_minLength) ++stats.nPreShortReads;
 		}
 		
 		if(readLength < 1 || readLength2 < 1) return;
@@ -70,41 +100,69 @@ public:
 		
 		if(cycle == PRELOAD){
 			
+			// identical pairs of bundle are aligned only once
+			if(m_dedup && ! alignments.addToGroup(getPairKey(seqRead, seqRead2))) return;
+			
+			// ungapped detection needs no preloaded alignments
+			if(m_ungapped) return;
+			
 			if(idxAl == 0) reserve(alignments.aset, m_bundleSize);
 			
-			TSeqStr rcSeq2 = seqRead2.seq;
+			alignments.seqs.push_back(seqRead2.seq);
+			
+			TSeqStr &rcSeq2 = alignments.seqs.back();
 			seqan::reverseComplement(rcSeq2);
 			
 			TAlign align;
 			appendValue(alignments.aset, align);
 			resize(rows(alignments.aset[idxAl]), 2);
 			
-			assignSource(row(alignments.aset[idxAl], 0), seqRead.seq);
-			assignSource(row(alignments.aset[idxAl], 1), rcSeq2);
+			assignSource(row(alignments.aset[idxAl], 0), infix(seqRead.seq, 0, readLength));
+			assignSource(row(alignments.aset[idxAl], 1), infix(rcSeq2, 0, readLength2));
 			
 			++idxAl;
 			return;
 		}
 		
 		TAlignResults a;
+		int group = -1;
+		
+		if(m_dedup) group = alignments.groups[alignments.idxGroup++];
 		
-		m_algo.alignGlobal(a, alignments, cycle, idxAl++, ANY);
+		if(group >= 0 && alignments.groupQuery[group] != -2){
+			a = alignments.groupResults[group];
+		}
+		else {
+			if(m_ungapped) m_ualgo.alignUngappedRC(a, seqRead.seq, seqRead2.seq, ANY);
+			else           m_algo.alignGlobal(a, alignments, cycle, idxAl++, ANY, 0);
+			
+			if(group >= 0){
+				alignments.groupQuery[group]   = 0;
+				alignments.groupResults[group] = a;
+			}
+		}
 		
 		a.overlapLength = a.endPos - a.startPos;
 		a.allowedErrors = m_errorRate * a.overlapLength;
 		
 		float madeErrors = static_cast<float>(a.mismatches + a.gapsR + a.gapsA);
 		
-		stringstream s;
-		
 		// check if alignment is valid, number of errors and overlap length
 		if((a.startPosA < a.startPosS || a.endPosA < a.endPosS) && madeErrors <= a.allowedErrors && a.overlapLength >= m_minOverlap){
 			
+			// insert of pair determines cut positions of both reads
+			bool cutInsert = (m_poMode == PINSERT);
+			
+			if(cutInsert && m_verify){
+				if(a.startPosA < a.startPosS && ! isAdapterOverhang(seqRead2.seq, readLength2 - a.startPosS, m_adapters2))        cutInsert = false;
+				if(a.endPosA   < a.endPosS   && ! isAdapterOverhang(seqRead.seq,  readLength - (a.endPosS - a.endPosA), m_adapters)) cutInsert = false;
+			}
+			
 			if(a.startPosA < a.startPosS){
 				
 				seqRead2.pairOverlap = true;
 				
-				if(m_poMode == PONLY || (m_poMode == PSHORT && a.startPosS < m_aMinOverlap)){
+				if(m_poMode == PONLY || cutInsert || (m_poMode == PSHORT && a.startPosS < m_aMinOverlap)){
 					
 					unsigned int rCutPos = readLength2 - a.startPosS;
 					erase(seqRead2.seq, rCutPos, readLength2);
@@ -112,7 +170,7 @@ public:
 					if(m_format == FASTQ)
 					erase(seqRead2.qual, rCutPos, readLength2);
 					
-					++m_modified;
+					++stats.modified;
 					
 					seqRead2.poRemoval = true;
 					
@@ -124,7 +182,7 @@ public:
 				
 				seqRead.pairOverlap = true;
 				
-				if(m_poMode == PONLY || (m_poMode == PSHORT && (a.endPosS - a.endPosA) < m_aMinOverlap)){
+				if(m_poMode == PONLY || cutInsert || (m_poMode == PSHORT && (a.endPosS - a.endPosA) < m_aMinOverlap)){
 					
 					unsigned int rCutPos = readLength - (a.endPosS - a.endPosA);
 					erase(seqRead.seq, rCutPos, readLength);
@@ -132,7 +190,7 @@ public:
 					if(m_format == FASTQ)
 					erase(seqRead.qual, rCutPos, readLength);
 					
-					++m_modified;
+					++stats.modified;
 					
 					seqRead.poRemoval = true;
 					
@@ -140,15 +198,17 @@ public:
 				}
 			}
 			
-			++m_overlaps;
+			++stats.overlaps;
 			
 			// store overlap occurrences
-			if(a.overlapLength <= MAX_READLENGTH) m_overlapLengths.at(a.overlapLength)++;
+			if(a.overlapLength <= MAX_READLENGTH) stats.overlapLengths.at(a.overlapLength)++;
 			else cerr << "\nCompile Flexbar with larger max read length for correct overlap stats.\n" << endl;
 			
 			// alignment stats
 			if(m_log == ALL || m_log == MOD){
 				
+				ostream &s = m_alignLog->stream();
+				
 				s << "Sequence removal:\n";
 				
 				s << "  read id          " << seqRead.id                          << "\n"
@@ -172,23 +232,77 @@ public:
 				s << "\n  Alignment:\n" << endl << a.alString;
 			}
 			else if(m_log == TAB){
+				ostream &s = m_alignLog->stream();
+				
 				s << seqRead.id   << "\t" << seqRead2.id       << "\t"
 				  << a.startPosA  << "\t" << a.endPosA         << "\t" << a.overlapLength << "\t"
 				  << a.mismatches << "\t" << a.gapsR + a.gapsA << "\t" << a.allowedErrors << endl;
 			}
 		}
 		else if(m_log == ALL){
+			ostream &s = m_alignLog->stream();
+			
 			s << "Unvalid alignment:"        << "\n"
 			  << "read id   " << seqRead.id  << "\n"
 			  << "read2 id  " << seqRead2.id << "\n\n" << endl;
 		}
 		
-		*m_out << s.str();
-		
 		return;
 	}
 	
 	
+	std::string getPairKey(const flexbar::TSeqRead &seqRead, const flexbar::TSeqRead &seqRead2){
+		
+		std::string key(reinterpret_cast<const char*>(rawSeq(seqRead.seq)), length(seqRead.seq));
+		
+		key += '|';
+		key.append(reinterpret_cast<const char*>(rawSeq(seqRead2.seq)), length(seqRead2.seq));
+		
+		return key;
+	}
+	
+	
+	// overhang of read beyond insert should start with an adapter
+	bool isAdapterOverhang(const TSeqStr &seq, const unsigned int cutPos, tbb::concurrent_vector<flexbar::TBar> *adapters){
+		
+		using namespace flexbar;
+		
+		const unsigned int overhang = length(seq) - cutPos;
+		
+		for(unsigned int i = 0; i < adapters->size(); ++i){
+			
+			if(adapters->at(i).rcAdapter) continue;
+			
+			const TSeqStr &adapter = adapters->at(i).seq;
+			
+			unsigned int len     = std::min<unsigned int>(overhang, length(adapter));
+			unsigned int allowed = m_errorRate * len;
+			
+			if(countMismatches(rawSeq(seq) + cutPos, rawSeq(adapter), len, allowed, true) <= allowed) return true;
+		}
+		return false;
+	}
+	
+	
+	// adds statistics of all threads to totals
+	void mergeStats(){
+		
+		typedef typename tbb::enumerable_thread_specific<PairStats>::iterator TStatsIter;
+		
+		for(TStatsIter it = m_stats.begin(); it != m_stats.end(); ++it){
+			
+			m_nPreShortReads += it->nPreShortReads;
+			m_overlaps       += it->overlaps;
+			m_modified       += it->modified;
+			
+			for(unsigned int i = 0; i <= flexbar::MAX_READLENGTH; ++i)
+				m_overlapLengths.at(i) += it->overlapLengths.at(i);
+		}
+		
+		m_stats.clear();
+	}
+	
+	
 	std::string getOverlapStatsString(){
 		
 		using namespace std;
@@ -18,11 +18,12 @@ private:
 	
 	const bool m_preProcess, m_useStdin, m_qtrimPostRm, m_iupacInput;
 	const int m_maxUncalled, m_preTrimBegin, m_preTrimEnd, m_qtrimThresh, m_qtrimWinSize;
-	tbb::atomic<unsigned long> m_nrReads, m_nrChars, m_nLowPhred;
+	std::atomic<unsigned long> m_nrReads, m_nrChars, m_nLowPhred;
+	StageTimers *m_timers;
 	
 public:
 	
-	SeqInput(const Options &o, const std::string filePath, const bool preProcess, const bool useStdin) :
+	SeqInput(const Options &o, const std::string filePath, const bool preProcess, const bool useStdin, StageTimers *timers) :
 		
 		m_preProcess(preProcess),
 		m_useStdin(useStdin),
@@ -37,7 +38,8 @@ public:
 		m_format(o.format),
 		m_nrReads(0),
 		m_nrChars(0),
-		m_nLowPhred(0){
+		m_nLowPhred(0),
+		m_timers(timers){
 		
 		using namespace std;
 		
@@ -73,6 +75,8 @@ public:
 		try{
 			if(! atEnd(seqFileIn)){
 				
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				
 				reserve(ids,      nReads);
 				reserve(seqs,     nReads);
 				reserve(uncalled, nReads);
@@ -103,6 +107,10 @@ public:
 					seqs = seqsIupac;
 				}
 				
+				m_timers->addTime(StageTimers::INPUT_DECODE, start, length(ids));
+				
+				start = std::chrono::steady_clock::now();
+				
 				for(unsigned int i = 0; i < length(ids); ++i){
 					
 					TString &id  =  ids[i];
@@ -153,6 +161,8 @@ public:
 					}
 				}
 				
+				m_timers->addTime(StageTimers::INPUT_PREPROCESS, start, length(ids));
+				
 				m_nrReads += length(ids);
 				
 				return length(ids);
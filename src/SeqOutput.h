@@ -18,7 +18,7 @@ private:
 	const bool m_switch2Fasta, m_writeLenDist, m_useStdout;
 	const unsigned int m_minLength, m_cutLen_read;
 	
-	tbb::atomic<unsigned long> m_countGood, m_countGoodChars;
+	std::atomic<unsigned long> m_countGood, m_countGoodChars;
 	tbb::concurrent_vector<unsigned long> m_lengthDist;
 	
 public:
@@ -0,0 +1,454 @@
+// SimdKernels.h
+
+#ifndef FLEXBAR_SIMDKERNELS_H
+#define FLEXBAR_SIMDKERNELS_H
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+namespace flexbar{
+	
+	// rank of N in Dna5 alphabet, acts as wildcard in comparisons
+	const unsigned char DNA5_N = 4;
+	
+	
+	// raw Dna5 ranks of a sequence stored in contiguous memory
+	template <typename TSeq>
+	inline const unsigned char* rawSeq(const TSeq &seq){
+		
+		return reinterpret_cast<const unsigned char*>(&*begin(seq, seqan::Standard()));
+	}
+	
+	
+	// Number of mismatches of two Dna5 stretches with equal length. N in query
+	// and optionally in read matches any base. Stops counting above bound.
+	inline unsigned int countMismatches(const unsigned char *read, const unsigned char *query, const unsigned int len, const unsigned int bound, const bool readWildcard){
+		
+		unsigned int mismatches = 0;
+		unsigned int i = 0;
+		
+		#if defined(__AVX2__)
+		const __m256i n32 = _mm256_set1_epi8(DNA5_N);
+		
+		for(; i + 32 <= len; i += 32){
+			
+			__m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(read  + i));
+			__m256i q = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(query + i));
+			
+			__m256i eq = _mm256_or_si256(_mm256_cmpeq_epi8(r, q), _mm256_cmpeq_epi8(q, n32));
+			if(readWildcard) eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(r, n32));
+			
+			mismatches += 32 - __builtin_popcount(static_cast<unsigned int>(_mm256_movemask_epi8(eq)));
+			
+			if(mismatches > bound) return mismatches;
+		}
+		#endif
+		
+		#if defined(__SSE2__)
+		const __m128i n16 = _mm_set1_epi8(DNA5_N);
+		
+		for(; i + 16 <= len; i += 16){
+			
+			__m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(read  + i));
+			__m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(query + i));
+			
+			__m128i eq = _mm_or_si128(_mm_cmpeq_epi8(r, q), _mm_cmpeq_epi8(q, n16));
+			if(readWildcard) eq = _mm_or_si128(eq, _mm_cmpeq_epi8(r, n16));
+			
+			mismatches += 16 - __builtin_popcount(static_cast<unsigned int>(_mm_movemask_epi8(eq)));
+			
+			if(mismatches > bound) return mismatches;
+		}
+		#endif
+		
+		for(; i < len; ++i){
+			
+			if(read[i] != query[i] && query[i] != DNA5_N && (read[i] != DNA5_N || ! readWildcard)){
+				if(++mismatches > bound) return mismatches;
+			}
+		}
+		return mismatches;
+	}
+	
+	
+	// Mismatches of read and reverse complement of mate. Mate is read backwards
+	// starting at mateEnd, so read[i] is compared to complement of mateEnd[-i].
+	inline unsigned int countMismatchesRC(const unsigned char *read, const unsigned char *mateEnd, const unsigned int len, const unsigned int bound, const bool readWildcard){
+		
+		unsigned int mismatches = 0;
+		unsigned int i = 0;
+		
+		#if defined(__SSSE3__)
+		const __m128i n16   = _mm_set1_epi8(DNA5_N);
+		const __m128i t16   = _mm_set1_epi8(3);
+		const __m128i rev16 = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		
+		#if defined(__AVX2__)
+		const __m256i n32   = _mm256_set1_epi8(DNA5_N);
+		const __m256i t32   = _mm256_set1_epi8(3);
+		const __m256i rev32 = _mm256_broadcastsi128_si256(rev16);
+		
+		for(; i + 32 <= len; i += 32){
+			
+			__m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(read + i));
+			__m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mateEnd - i - 31));
+			
+			// reverse bytes within lanes and swap lanes
+			m = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(m, rev32), 0x4E);
+			
+			// complement of A, C, G and T is 3 - rank, N is wildcard
+			__m256i eq = _mm256_or_si256(_mm256_cmpeq_epi8(r, _mm256_sub_epi8(t32, m)), _mm256_cmpeq_epi8(m, n32));
+			if(readWildcard) eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(r, n32));
+			
+			mismatches += 32 - __builtin_popcount(static_cast<unsigned int>(_mm256_movemask_epi8(eq)));
+			
+			if(mismatches > bound) return mismatches;
+		}
+		#endif
+		
+		for(; i + 16 <= len; i += 16){
+			
+			__m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(read + i));
+			__m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mateEnd - i - 15));
+			
+			m = _mm_shuffle_epi8(m, rev16);
+			
+			__m128i eq = _mm_or_si128(_mm_cmpeq_epi8(r, _mm_sub_epi8(t16, m)), _mm_cmpeq_epi8(m, n16));
+			if(readWildcard) eq = _mm_or_si128(eq, _mm_cmpeq_epi8(r, n16));
+			
+			mismatches += 16 - __builtin_popcount(static_cast<unsigned int>(_mm_movemask_epi8(eq)));
+			
+			if(mismatches > bound) return mismatches;
+		}
+		#endif
+		
+		for(; i < len; ++i){
+			
+			const unsigned char m = *(mateEnd - i);
+			
+			if(read[i] != 3 - m && m != DNA5_N && (read[i] != DNA5_N || ! readWildcard)){
+				if(++mismatches > bound) return mismatches;
+			}
+		}
+		return mismatches;
+	}
+	
+	
+	// Moves cut to longest prefix within block at pos that ends with nuc and
+	// has at most maxErrors[length] other bases. Bit j of eq is set if base at
+	// pos + j equals nuc.
+	inline void homopolymerPrefixBlock(const unsigned int eq, const unsigned int width, const unsigned int pos, unsigned int &notNuc, unsigned int &cut, const unsigned int *maxErrors){
+		
+		const unsigned int mis = ~eq & ((width == 32) ? ~0u : (1u << width) - 1);
+		
+		for(unsigned int c = eq; c != 0; c &= ~(1u << (31 - __builtin_clz(c)))){
+			
+			const unsigned int j = 31 - __builtin_clz(c);
+			
+			if(notNuc + __builtin_popcount(mis & ((1u << j) - 1)) <= maxErrors[pos + j + 1]){
+				cut = pos + j + 1;
+				break;
+			}
+		}
+		notNuc += __builtin_popcount(mis);
+	}
+	
+	
+	// Moves cut to longest suffix within block that ends done bases before end
+	// of sequence. Bit j of eq is set if base j of block equals nuc.
+	inline void homopolymerSuffixBlock(const unsigned int eq, const unsigned int width, const unsigned int done, unsigned int &notNuc, unsigned int &cut, const unsigned int *maxErrors){
+		
+		const unsigned int mis = ~eq & ((width == 32) ? ~0u : (1u << width) - 1);
+		
+		for(unsigned int c = eq; c != 0; c &= c - 1){
+			
+			const unsigned int j = __builtin_ctz(c);
+			const unsigned int above = (j == 31) ? 0 : mis >> (j + 1);
+			
+			if(notNuc + __builtin_popcount(above) <= maxErrors[done + width - j]){
+				cut = done + width - j;
+				break;
+			}
+		}
+		notNuc += __builtin_popcount(mis);
+	}
+	
+	
+	// Length of longest prefix up to limit that ends with nuc and has at most
+	// maxErrors[length] other bases. Counts are non-decreasing in length.
+	inline unsigned int homopolymerPrefix(const unsigned char *seq, const unsigned int limit, const unsigned char nuc, const unsigned int *maxErrors){
+		
+		const unsigned int bound = maxErrors[limit];
+		
+		unsigned int notNuc = 0;
+		unsigned int cut    = 0;
+		unsigned int i      = 0;
+		
+		#if defined(__AVX2__)
+		const __m256i n32 = _mm256_set1_epi8(nuc);
+		
+		for(; i + 32 <= limit; i += 32){
+			
+			__m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq + i));
+			
+			homopolymerPrefixBlock(static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(r, n32))), 32, i, notNuc, cut, maxErrors);
+			
+			if(notNuc > bound) return cut;
+		}
+		#endif
+		
+		#if defined(__SSE2__)
+		const __m128i n16 = _mm_set1_epi8(nuc);
+		
+		for(; i + 16 <= limit; i += 16){
+			
+			__m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + i));
+			
+			homopolymerPrefixBlock(static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(r, n16))), 16, i, notNuc, cut, maxErrors);
+			
+			if(notNuc > bound) return cut;
+		}
+		#endif
+		
+		for(; i < limit; ++i){
+			
+			if(seq[i] != nuc){
+				if(++notNuc > bound) return cut;
+			}
+			else if(notNuc <= maxErrors[i + 1]) cut = i + 1;
+		}
+		return cut;
+	}
+	
+	
+	// Length of longest suffix up to limit of sequence with length len that
+	// starts with nuc and has at most maxErrors[length] other bases.
+	inline unsigned int homopolymerSuffix(const unsigned char *seq, const unsigned int len, const unsigned int limit, const unsigned char nuc, const unsigned int *maxErrors){
+		
+		const unsigned int bound = maxErrors[limit];
+		
+		unsigned int notNuc = 0;
+		unsigned int cut    = 0;
+		unsigned int k      = 0;
+		
+		#if defined(__AVX2__)
+		const __m256i n32 = _mm256_set1_epi8(nuc);
+		
+		for(; k + 32 <= limit; k += 32){
+			
+			__m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq + len - k - 32));
+			
+			homopolymerSuffixBlock(static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(r, n32))), 32, k, notNuc, cut, maxErrors);
+			
+			if(notNuc > bound) return cut;
+		}
+		#endif
+		
+		#if defined(__SSE2__)
+		const __m128i n16 = _mm_set1_epi8(nuc);
+		
+		for(; k + 16 <= limit; k += 16){
+			
+			__m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + len - k - 16));
+			
+			homopolymerSuffixBlock(static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(r, n16))), 16, k, notNuc, cut, maxErrors);
+			
+			if(notNuc > bound) return cut;
+		}
+		#endif
+		
+		for(; k < limit; ++k){
+			
+			if(seq[len - 1 - k] != nuc){
+				if(++notNuc > bound) return cut;
+			}
+			else if(notNuc <= maxErrors[k + 1]) cut = k + 1;
+		}
+		return cut;
+	}
+	
+	
+	// Position after last quality of at least cutoff, zero if there is none.
+	inline unsigned int qualityTailCut(const unsigned char *qual, const unsigned int len, const unsigned int cutoff){
+		
+		if(cutoff > 255) return 0;
+		
+		unsigned int i = len;
+		
+		#if defined(__AVX2__)
+		const __m256i c32 = _mm256_set1_epi8(cutoff);
+		
+		for(; i >= 32; i -= 32){
+			
+			__m256i q = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qual + i - 32));
+			
+			unsigned int ge = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(q, c32), q));
+			
+			if(ge != 0) return i - 32 + (32 - __builtin_clz(ge));
+		}
+		#endif
+		
+		#if defined(__SSE2__)
+		const __m128i c16 = _mm_set1_epi8(cutoff);
+		
+		for(; i >= 16; i -= 16){
+			
+			__m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(qual + i - 16));
+			
+			unsigned int ge = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(q, c16), q));
+			
+			if(ge != 0) return i - 16 + (32 - __builtin_clz(ge));
+		}
+		#endif
+		
+		for(; i > 0; --i){
+			if(qual[i - 1] >= cutoff) return i;
+		}
+		return 0;
+	}
+	
+	
+	// Start of first window with average quality below cutoff, or length of
+	// read. Windows are shortened at read end. Sums of quality minus cutoff
+	// are computed for 16 or 8 window starts at once.
+	inline unsigned int qualityWindowCut(const unsigned char *qual, const unsigned int len, const unsigned int cutoff, const unsigned int window){
+		
+		const int c = cutoff;
+		
+		unsigned int i = 0;
+		
+		// 16 bit sums without overflow
+		if(window > 0 && window <= 128 && cutoff <= 255){
+			
+			#if defined(__AVX2__)
+			const __m256i c16 = _mm256_set1_epi16(cutoff);
+			
+			for(; i + 16 + window <= len + 1; i += 16){
+				
+				__m256i sum = _mm256_setzero_si256();
+				
+				for(unsigned int k = 0; k < window; ++k){
+					
+					__m256i q = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(qual + i + k)));
+					
+					sum = _mm256_add_epi16(sum, _mm256_sub_epi16(q, c16));
+				}
+				
+				unsigned int bad = _mm256_movemask_epi8(_mm256_cmpgt_epi16(_mm256_setzero_si256(), sum));
+				
+				if(bad != 0) return i + __builtin_ctz(bad) / 2;
+			}
+			#endif
+			
+			#if defined(__SSE2__)
+			const __m128i c8   = _mm_set1_epi16(cutoff);
+			const __m128i zero = _mm_setzero_si128();
+			
+			for(; i + 8 + window <= len + 1; i += 8){
+				
+				__m128i sum = zero;
+				
+				for(unsigned int k = 0; k < window; ++k){
+					
+					__m128i q = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(qual + i + k)), zero);
+					
+					sum = _mm_add_epi16(sum, _mm_sub_epi16(q, c8));
+				}
+				
+				unsigned int bad = _mm_movemask_epi8(_mm_cmpgt_epi16(zero, sum));
+				
+				if(bad != 0) return i + __builtin_ctz(bad) / 2;
+			}
+			#endif
+		}
+		
+		int sum = 0;
+		
+		for(unsigned int k = i; k < len && k < i + window; ++k){
+			sum += qual[k] - c;
+		}
+		
+		// shift window and update sum in constant time
+		for(; i < len; ++i){
+			
+			if(sum < 0) return i;
+			
+			sum -= qual[i] - c;
+			
+			if(i + window < len) sum += qual[i + window] - c;
+		}
+		return len;
+	}
+	
+	
+	// BWA trimming to argmax_x of sum_{i=x+1}^l (cutoff - q_i). Sums of 8
+	// positions at read end are computed at once, those with new maximum or
+	// negative sum are resolved individually.
+	inline unsigned int qualityBwaCut(const unsigned char *qual, const unsigned int len, const unsigned int cutoff){
+		
+		const int c = cutoff;
+		
+		int maxArg = len - 1, sum = 0, max = 0;
+		
+		unsigned int i = len;
+		
+		#if defined(__SSE2__)
+		const __m128i c8   = _mm_set1_epi16(cutoff);
+		const __m128i zero = _mm_setzero_si128();
+		
+		for(; i >= 8 && cutoff <= 255; i -= 8){
+			
+			__m128i q = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(qual + i - 8)), zero);
+			
+			// suffix sums within block
+			__m128i x = _mm_sub_epi16(c8, q);
+			
+			x = _mm_add_epi16(x, _mm_srli_si128(x, 2));
+			x = _mm_add_epi16(x, _mm_srli_si128(x, 4));
+			x = _mm_add_epi16(x, _mm_srli_si128(x, 8));
+			
+			__m128i base = _mm_set1_epi32(sum);
+			__m128i lo   = _mm_add_epi32(base, _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+			__m128i hi   = _mm_add_epi32(base, _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+			
+			// stop at negative sum within block
+			if(_mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi32(lo, zero), _mm_cmplt_epi32(hi, zero))) != 0) break;
+			
+			__m128i m = _mm_set1_epi32(max);
+			
+			if(_mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi32(lo, m), _mm_cmpgt_epi32(hi, m))) != 0){
+				
+				int sums[8];
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(sums),     lo);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(sums + 4), hi);
+				
+				for(int l = 7; l >= 0; --l){
+					if(sums[l] > max){
+						max    = sums[l];
+						maxArg = i - 8 + l;
+					}
+				}
+			}
+			sum = _mm_cvtsi128_si32(lo);
+		}
+		#endif
+		
+		for(; i > 0; --i){
+			
+			sum += c - qual[i - 1];
+			
+			if(sum < 0) break;
+			
+			if(sum > max){
+				max    = sum;
+				maxArg = i - 1;
+			}
+		}
+		return maxArg + 1;
+	}
+
+}
+
+#endif
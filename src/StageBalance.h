@@ -0,0 +1,126 @@
+// StageBalance.h
+
+#ifndef FLEXBAR_STAGEBALANCE_H
+#define FLEXBAR_STAGEBALANCE_H
+
+
+// Measures time of input decoding, alignment and output encoding for each
+// bundle. Serial input and output stages decode or encode their files in
+// parallel tasks while they limit throughput of pipeline. Tasks run in the
+// same arena as alignment, so threads move between stages as needed. Work
+// is split by file only, a stage with a single stream stays serial.
+class StageBalance {
+
+public:
+	
+	enum Stage {
+		INPUT,
+		ALIGN,
+		OUTPUT
+	};
+	
+private:
+	
+	const unsigned int m_nThreads;
+	
+	// total time in ns and number of bundles of each stage
+	std::atomic<unsigned long> m_time[3], m_nBundles[3];
+	
+	std::atomic<bool> m_parallel[3];
+	std::atomic<unsigned long> m_nParallel[3];
+	
+	// number of files of stage, set by filters at construction
+	unsigned int m_nStreams[3];
+	
+public:
+	
+	StageBalance(const Options &o) :
+		
+		m_nThreads(o.nThreads){
+		
+		for(unsigned int i = 0; i < 3; ++i){
+			m_time[i]      = 0;
+			m_nBundles[i]  = 0;
+			m_parallel[i]  = false;
+			m_nParallel[i] = 0;
+			m_nStreams[i]  = 1;
+		}
+	};
+	
+	
+	// adds time of stage for bundle that started at given time
+	void addTime(const Stage stage, const std::chrono::steady_clock::time_point &start){
+		
+		std::chrono::nanoseconds time = std::chrono::steady_clock::now() - start;
+		
+		m_time[stage] += time.count();
+		m_nBundles[stage]++;
+		
+		if(isParallel(stage)) m_nParallel[stage]++;
+		
+		if(stage != ALIGN) updateStage(stage);
+	}
+	
+	
+	void setNrStreams(const Stage stage, const unsigned int nStreams){
+		m_nStreams[stage] = nStreams;
+	}
+	
+	
+	// whether serial stage should use parallel tasks for next bundle
+	bool isParallel(const Stage stage) const {
+		return m_parallel[stage] && m_nStreams[stage] > 1;
+	}
+	
+	
+	void printStageBalance(std::ostream *out) const {
+		
+		using namespace std;
+		
+		double total = 0;
+		
+		for(unsigned int i = 0; i < 3; ++i) total += m_time[i];
+		
+		// nothing to balance without several files in input or output
+		if(total == 0 || m_nThreads < 2 || (m_nStreams[INPUT] < 2 && m_nStreams[OUTPUT] < 2)) return;
+		
+		*out << "Time of stages:     input " << static_cast<int>(100 * m_time[INPUT] / total + 0.5) << "%, ";
+		*out << "alignment "                 << static_cast<int>(100 * m_time[ALIGN] / total + 0.5) << "%, ";
+		*out << "output "                    << static_cast<int>(100 * m_time[OUTPUT] / total + 0.5) << "%\n";
+		
+		if(m_nStreams[INPUT] > 1)
+		*out << "Parallel input:     " << m_nParallel[INPUT]  << " of " << m_nBundles[INPUT]  << " bundles\n";
+		
+		if(m_nStreams[OUTPUT] > 1)
+		*out << "Parallel output:    " << m_nParallel[OUTPUT] << " of " << m_nBundles[OUTPUT] << " bundles\n";
+	}
+	
+private:
+	
+	double getAverage(const Stage stage) const {
+		
+		unsigned long nBundles = m_nBundles[stage];
+		
+		if(nBundles == 0) return 0;
+		
+		return static_cast<double>(m_time[stage]) / nBundles;
+	}
+	
+	
+	// Serial stage limits pipeline if its time per bundle exceeds alignment
+	// time per bundle divided by threads. Parallel tasks are switched off
+	// again below half of this time to avoid oscillation.
+	void updateStage(const Stage stage){
+		
+		if(m_nThreads < 2 || m_nBundles[ALIGN] == 0) return;
+		
+		double alignTime = getAverage(ALIGN) / m_nThreads;
+		double stageTime = getAverage(stage);
+		
+		     if(stageTime > alignTime)     m_parallel[stage] = true;
+		else if(stageTime < alignTime / 2) m_parallel[stage] = false;
+	}
+	
+};
+
+#endif
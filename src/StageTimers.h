@@ -0,0 +1,365 @@
+// StageTimers.h
+
+#ifndef FLEXBAR_STAGETIMERS_H
+#define FLEXBAR_STAGETIMERS_H
+
+#include <fstream>
+#include <iomanip>
+
+
+// Times of pipeline stages and their steps in ns, summed in buffers of threads
+// and combined for output. Steps are timed for each bundle or file of bundle,
+// so timing costs are negligible compared to processing of reads. In trace
+// mode each timed span is kept with its thread and bundle for a trace file
+// in chrome trace format, to view bundles of pipeline in a trace viewer.
+class StageTimers {
+
+public:
+	
+	enum Step {
+		INPUT,
+		INPUT_DECODE,
+		INPUT_PREPROCESS,
+		ALIGN,
+		ALIGN_BARCODES,
+		ALIGN_PAIRS,
+		ALIGN_ADAPTERS,
+		ALIGN_HTRIM,
+		OUTPUT,
+		OUTPUT_LOG,
+		OUTPUT_READS,
+		NSTEPS
+	};
+	
+private:
+	
+	struct StepTimes {
+		
+		unsigned long time[NSTEPS], calls[NSTEPS], reads[NSTEPS];
+		
+		StepTimes(){
+			for(unsigned int i = 0; i < NSTEPS; ++i){
+				time[i]  = 0;
+				calls[i] = 0;
+				reads[i] = 0;
+			}
+		}
+	};
+	
+	struct TraceEvent {
+		
+		const char *name;
+		long start, end;
+		unsigned long bundle;
+		unsigned int nReads;
+	};
+	
+	typedef tbb::enumerable_thread_specific<StepTimes> TThreadTimes;
+	typedef tbb::enumerable_thread_specific<std::vector<TraceEvent> > TThreadEvents;
+	
+	// numbers of bundles in input order, pointers are reused for later bundles
+	typedef tbb::concurrent_hash_map<const void*, unsigned long> TBundleIds;
+	
+	const unsigned int m_nThreads;
+	const bool m_trace;
+	
+	TThreadTimes m_times;
+	TThreadEvents m_events;
+	TBundleIds m_bundleIds;
+	std::atomic<unsigned long> m_nBundles;
+	StepTimes m_total;
+	
+	std::chrono::steady_clock::time_point m_start, m_end;
+	
+	// end of last input and time input waited for free tokens
+	std::chrono::steady_clock::time_point m_inputEnd;
+	unsigned long m_tokenWait;
+	
+public:
+	
+	StageTimers(const Options &o) :
+		
+		m_nThreads(o.nThreads),
+		m_trace(o.traceBundles),
+		m_nBundles(0),
+		m_start(std::chrono::steady_clock::now()),
+		m_end(m_start),
+		m_inputEnd(m_start),
+		m_tokenWait(0){
+	};
+	
+	
+	// adds time of step that started at given time for number of reads
+	void addTime(const Step step, const std::chrono::steady_clock::time_point &start, const unsigned int nReads, const void *bundle = NULL){
+		
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		
+		StepTimes &t = m_times.local();
+		
+		t.time[step]  += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		t.reads[step] += nReads;
+		t.calls[step]++;
+		
+		if(step == INPUT) m_inputEnd = end;
+		
+		if(m_trace){
+			
+			// input step numbers loaded bundle
+			if(step == INPUT && bundle != NULL){
+				TBundleIds::accessor acc;
+				m_bundleIds.insert(acc, bundle);
+				acc->second = ++m_nBundles;
+			}
+			
+			addEvent(getKey(step), start, end, nReads, bundle);
+		}
+	}
+	
+	
+	// adds span of trace without time of step, e.g. a cycle of step
+	void addSpan(const char *name, const std::chrono::steady_clock::time_point &start, const unsigned int nReads, const void *bundle){
+		
+		if(m_trace) addEvent(name, start, std::chrono::steady_clock::now(), nReads, bundle);
+	}
+	
+	
+	// called by serial input at start, input is idle since last bundle
+	// while pipeline has no free tokens
+	void addTokenWait(const std::chrono::steady_clock::time_point &start){
+		
+		if(m_inputEnd != m_start) m_tokenWait += std::chrono::duration_cast<std::chrono::nanoseconds>(start - m_inputEnd).count();
+	}
+	
+	
+	// ends wall time and sums times of threads
+	void finish(){
+		
+		m_end = std::chrono::steady_clock::now();
+		
+		for(TThreadTimes::const_iterator it = m_times.begin(); it != m_times.end(); ++it){
+			for(unsigned int i = 0; i < NSTEPS; ++i){
+				m_total.time[i]  += it->time[i];
+				m_total.calls[i] += it->calls[i];
+				m_total.reads[i] += it->reads[i];
+			}
+		}
+	}
+	
+	
+	void printStageTimes(std::ostream *out) const {
+		
+		using namespace std;
+		
+		double stages = m_total.time[INPUT] + m_total.time[ALIGN] + m_total.time[OUTPUT];
+		
+		if(stages == 0) return;
+		
+		*out << "Stage times           thread sec   share      reads/s\n";
+		
+		for(unsigned int i = 0; i < NSTEPS; ++i){
+			
+			if(m_total.calls[i] == 0) continue;
+			
+			double sec = m_total.time[i] / 1e9;
+			
+			*out << "  " << left << setw(20) << getName(static_cast<Step>(i)) << right;
+			*out << fixed << setprecision(3) << setw(10) << sec;
+			*out << setprecision(1) << setw(7) << 100 * m_total.time[i] / stages << "%";
+			
+			if(sec > 0 && m_total.reads[i] > 0) *out << setw(13) << static_cast<unsigned long>(m_total.reads[i] / sec);
+			
+			*out << "\n";
+		}
+		
+		*out << setprecision(3);
+		*out << "Waiting for tokens:  " << m_tokenWait / 1e9 << " sec\n";
+		
+		*out << setprecision(1);
+		*out << "Serial input busy:   " << 100 * getUtilization(INPUT,  1)          << "% of wall time\n";
+		*out << "Serial output busy:  " << 100 * getUtilization(OUTPUT, 1)          << "% of wall time\n";
+		*out << "Alignment busy:      " << 100 * getUtilization(ALIGN,  m_nThreads) << "% of thread time\n";
+		
+		out->unsetf(ios::floatfield);
+		*out << setprecision(6);
+	}
+	
+	
+	void writeStageTimes(const std::string &fname) const {
+		
+		using namespace std;
+		
+		fstream jstream;
+		
+		jstream.open(fname.c_str(), ios::out | ios::binary);
+		
+		if(! jstream.is_open()){
+			cerr << "\nERROR: Could not open file " << fname << "\n";
+			return;
+		}
+		
+		jstream << "{\n";
+		jstream << "  \"wall_seconds\": " << getWallTime() << ",\n";
+		jstream << "  \"threads\": " << m_nThreads << ",\n";
+		jstream << "  \"token_wait_seconds\": " << m_tokenWait / 1e9 << ",\n";
+		jstream << "  \"utilization\": {\n";
+		jstream << "    \"input\": "  << getUtilization(INPUT,  1)          << ",\n";
+		jstream << "    \"output\": " << getUtilization(OUTPUT, 1)          << ",\n";
+		jstream << "    \"align\": "  << getUtilization(ALIGN,  m_nThreads) << "\n";
+		jstream << "  },\n";
+		jstream << "  \"steps\": {\n";
+		
+		for(unsigned int i = 0; i < NSTEPS; ++i){
+			
+			jstream << "    \"" << getKey(static_cast<Step>(i)) << "\": {";
+			jstream << "\"seconds\": " << m_total.time[i] / 1e9 << ", ";
+			jstream << "\"calls\": "   << m_total.calls[i]      << ", ";
+			jstream << "\"reads\": "   << m_total.reads[i]      << "}";
+			jstream << (i + 1 < NSTEPS ? ",\n" : "\n");
+		}
+		
+		jstream << "  },\n";
+		jstream << "  \"per_thread\": [\n";
+		
+		for(TThreadTimes::const_iterator it = m_times.begin(); it != m_times.end(); ++it){
+			
+			if(it != m_times.begin()) jstream << ",\n";
+			
+			jstream << "    {";
+			
+			for(unsigned int i = 0; i < NSTEPS; ++i){
+				jstream << "\"" << getKey(static_cast<Step>(i)) << "\": " << it->time[i] / 1e9;
+				jstream << (i + 1 < NSTEPS ? ", " : "}");
+			}
+		}
+		
+		jstream << "\n  ]\n";
+		jstream << "}\n";
+		
+		jstream.close();
+	}
+	
+	void writeTrace(const std::string &fname) const {
+		
+		using namespace std;
+		
+		fstream tstream;
+		
+		tstream.open(fname.c_str(), ios::out | ios::binary);
+		
+		if(! tstream.is_open()){
+			cerr << "\nERROR: Could not open file " << fname << "\n";
+			return;
+		}
+		
+		tstream << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+		tstream << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"flexbar\"}}";
+		
+		tstream << fixed << setprecision(3);
+		
+		unsigned int tid = 0;
+		
+		for(TThreadEvents::const_iterator it = m_events.begin(); it != m_events.end(); ++it){
+			
+			++tid;
+			
+			tstream << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid;
+			tstream << ", \"args\": {\"name\": \"thread " << tid << "\"}}";
+			
+			for(unsigned int i = 0; i < it->size(); ++i){
+				
+				const TraceEvent &e = it->at(i);
+				
+				// complete events with times in us
+				tstream << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid;
+				tstream << ", \"ts\": " << e.start / 1e3 << ", \"dur\": " << (e.end - e.start) / 1e3;
+				tstream << ", \"args\": {\"reads\": " << e.nReads;
+				
+				if(e.bundle > 0) tstream << ", \"bundle\": " << e.bundle;
+				
+				tstream << "}}";
+			}
+		}
+		
+		tstream << "\n]}\n";
+		
+		tstream.close();
+	}
+	
+private:
+	
+	void addEvent(const char *name, const std::chrono::steady_clock::time_point &start, const std::chrono::steady_clock::time_point &end, const unsigned int nReads, const void *bundle){
+		
+		using namespace std::chrono;
+		
+		TraceEvent e;
+		
+		e.name   = name;
+		e.start  = duration_cast<nanoseconds>(start - m_start).count();
+		e.end    = duration_cast<nanoseconds>(end   - m_start).count();
+		e.nReads = nReads;
+		e.bundle = 0;
+		
+		TBundleIds::const_accessor acc;
+		
+		if(bundle != NULL && m_bundleIds.find(acc, bundle)) e.bundle = acc->second;
+		
+		m_events.local().push_back(e);
+	}
+	
+	
+	double getWallTime() const {
+		return std::chrono::duration<double>(m_end - m_start).count();
+	}
+	
+	
+	// fraction of wall time of given threads spent in stage
+	double getUtilization(const Step step, const unsigned int nThreads) const {
+		
+		double wall = getWallTime() * nThreads;
+		
+		if(wall <= 0) return 0;
+		
+		return m_total.time[step] / 1e9 / wall;
+	}
+	
+	
+	const char* getName(const Step step) const {
+		
+		switch(step){
+			case INPUT:            return "input";
+			case INPUT_DECODE:     return "  decoding";
+			case INPUT_PREPROCESS: return "  pre-processing";
+			case ALIGN:            return "alignment";
+			case ALIGN_BARCODES:   return "  barcodes";
+			case ALIGN_PAIRS:      return "  pair overlap";
+			case ALIGN_ADAPTERS:   return "  adapters";
+			case ALIGN_HTRIM:      return "  homopolymers";
+			case OUTPUT:           return "output";
+			case OUTPUT_LOG:       return "  alignment log";
+			case OUTPUT_READS:     return "  encoding";
+			default:               return "";
+		}
+	}
+	
+	
+	const char* getKey(const Step step) const {
+		
+		switch(step){
+			case INPUT:            return "input";
+			case INPUT_DECODE:     return "input_decode";
+			case INPUT_PREPROCESS: return "input_preprocess";
+			case ALIGN:            return "align";
+			case ALIGN_BARCODES:   return "align_barcodes";
+			case ALIGN_PAIRS:      return "align_pair_overlap";
+			case ALIGN_ADAPTERS:   return "align_adapters";
+			case ALIGN_HTRIM:      return "align_htrim";
+			case OUTPUT:           return "output";
+			case OUTPUT_LOG:       return "output_log";
+			case OUTPUT_READS:     return "output_reads";
+			default:               return "";
+		}
+	}
+	
+};
+
+#endif
@@ -64,5 +64,71 @@ else
 echo "Test 5 OK"
 fi
 
+
+flexbar --reads reads.fastq --target result_right_cache --adapter-min-overlap 4 --adapters adapters.fasta --min-read-length 10 --adapter-error-rate 0.1 --adapter-trim-end RIGHT --adapter-cache 1000 > /dev/null
+
+a=`diff correct_result_right.fastq result_right_cache.fastq`
+
+if ! $a ; then
+echo "Error testing right mode with alignment cache fastq"
+echo $a
+exit 1
+else
+echo "Test 6 OK"
+fi
+
+
+flexbar --reads reads.fastq --target result_right_dedup --adapter-min-overlap 4 --adapters adapters.fasta --min-read-length 10 --adapter-error-rate 0.1 --adapter-trim-end RIGHT --dedup > /dev/null
+
+a=`diff correct_result_right.fastq result_right_dedup.fastq`
+
+if ! $a ; then
+echo "Error testing right mode with deduplication fastq"
+echo $a
+exit 1
+else
+echo "Test 7 OK"
+fi
+
+
+flexbar --reads reads.fastq --target result_right_reject --adapter-min-overlap 4 --adapters adapters.fasta --min-read-length 10 --adapter-error-rate 0.1 --adapter-trim-end RIGHT --min-read-reject > /dev/null
+
+# reads of length 13 and 14 are short prior to removal with min length 15
+flexbar --reads reads.fastq --target result_right_short --adapter-min-overlap 4 --adapters adapters.fasta --min-read-length 15 --adapter-error-rate 0.1 --adapter-trim-end RIGHT --htrim-right A > /dev/null
+
+sed -n '/^Adapter removal statistics/,$p' result_right_short.log > result_right_short_stats.txt
+cp result_right_short.fastq result_right_short_keep.fastq
+
+flexbar --reads reads.fastq --target result_right_short --adapter-min-overlap 4 --adapters adapters.fasta --min-read-length 15 --adapter-error-rate 0.1 --adapter-trim-end RIGHT --htrim-right A --min-read-reject > /dev/null
+
+sed -n '/^Adapter removal statistics/,$p' result_right_short.log > result_right_short_reject_stats.txt
+
+a=`diff correct_result_right.fastq result_right_reject.fastq`
+b=`diff result_right_short_keep.fastq result_right_short.fastq`
+c=`diff result_right_short_stats.txt result_right_short_reject_stats.txt`
+
+if ! $a || ! $b || ! $c ; then
+echo "Error testing right mode with early reject fastq"
+echo $a
+echo $b
+echo $c
+exit 1
+else
+echo "Test 8 OK"
+fi
+
+
+flexbar --reads reads.fastq --target result_right_memory --adapter-min-overlap 4 --adapters adapters.fasta --min-read-length 10 --adapter-error-rate 0.1 --adapter-trim-end RIGHT --threads 2 --tokens 4 --max-memory 1 > /dev/null
+
+a=`diff correct_result_right.fastq result_right_memory.fastq`
+
+if ! $a ; then
+echo "Error testing right mode with memory budget fastq"
+echo $a
+exit 1
+else
+echo "Test 9 OK"
+fi
+
 echo ""
 